@@ -0,0 +1,301 @@
+#!/usr/bin/python3
+#
+# Benchmark programu cluster.
+#
+# Pro kazdy druh dat a velikost vygeneruje vstup (gen_objects), spusti na nem
+# vsechny enginy s prepinacem --profile a zapise casy fazi a citace do CSV
+# a JSON. Enginy se single linkage musi dat platny rez hierarchie single
+# linkage (pri shodnych vzdalenostech muze byt platnych rezu vic).
+# Priklady pouziti:
+#     make bench
+#     python3 ./bench.py ./cluster_bench ./gen_objects --sizes 100 1000 --engines nn chain
+
+
+import argparse
+import csv
+import hashlib
+import json
+import os
+import re
+import struct
+import subprocess
+import tempfile
+import time
+from datetime import datetime, timezone
+from typing import Dict, List, Optional
+
+KINDS = ["uniform", "blobs", "dups"]
+
+DEFAULT_SIZES = [10**2, 10**3, 10**4, 10**5]
+
+# Argumenty enginu, zda jde o single linkage (vystup musi byt stejny)
+# a nejvetsi velikost vstupu, pro kterou se engine jeste spousti.
+# Pro druh 'dups' lze nastavit vlastni limit (slouceni bodu ho zmensi na
+# nejvyse 1000 mist).
+ENGINES: Dict[str, Dict] = {
+    "nn": {"args": [], "single": True, "max_n": 2 * 10**3},
+    "nn-dedup": {"args": ["--dedup"], "single": True, "max_n": 2 * 10**3, "max_n_dups": 10**7},
+    "chain": {"args": ["--engine=chain"], "single": True, "max_n": 10**5},
+    "chain-dedup": {"args": ["--engine=chain", "--dedup"], "single": True, "max_n": 10**5, "max_n_dups": 10**7},
+    "chain-ward": {"args": ["--engine=chain", "--method=ward"], "single": False, "max_n": 2 * 10**4},
+    "stream": {"args": ["--stream"], "single": False, "max_n": 10**7},
+}
+
+FIELDS = [
+    "date",
+    "commit",
+    "kind",
+    "n",
+    "engine",
+    "status",
+    "load_s",
+    "cluster_s",
+    "neighbours_s",
+    "merge_s",
+    "print_s",
+    "wall_s",
+    "dist_evals",
+    "merges",
+    "reallocs",
+    "remove_bytes",
+    "output_md5",
+    "same_output",
+    "valid_cut",
+]
+
+PASS = "\033[38;5;154m[OK]\033[0m"
+FAIL = "\033[38;5;196m[FAIL]\033[0m"
+SKIP = "\033[1;33m[SKIP]\033[0m"
+
+
+def git_commit() -> str:
+    try:
+        return subprocess.run(
+            ["git", "rev-parse", "--short", "HEAD"], capture_output=True, text=True
+        ).stdout.strip()
+    except Exception:
+        return ""
+
+
+def dataset(gen: str, data_dir: str, kind: str, n: int, seed: int) -> str:
+    path = os.path.join(data_dir, f"{kind}_{n}_{seed}.txt")
+    if not os.path.exists(path):
+        os.makedirs(data_dir, exist_ok=True)
+        with open(path + ".tmp", "w") as f:
+            subprocess.run([gen, kind, str(n), str(seed)], stdout=f, check=True)
+        os.replace(path + ".tmp", path)
+    return path
+
+
+# Radky 'profile: klic=hodnota ...' z --profile. Casy fazi jsou realna cisla
+# (v sekundach), citace cela cisla.
+def parse_profile(stderr: str) -> Optional[Dict]:
+    result: Dict = {}
+    for line in stderr.splitlines():
+        if not line.startswith("profile:"):
+            continue
+        for key, value in (item.split("=") for item in line.split()[1:] if "=" in item):
+            if "." in value:
+                result[key + "_s"] = float(value)
+            else:
+                result[key] = int(value)
+    return result or None
+
+
+def read_objects(path: str) -> Dict[int, tuple]:
+    with open(path) as f:
+        f.readline()
+        return {int(i): (x, y) for i, x, y in (line.split() for line in f)}
+
+
+def parse_partition(stdout: bytes) -> List[List[int]]:
+    return [
+        [int(i) for i in re.findall(rb"(-?\d+)\[", line)]
+        for line in stdout.splitlines()
+        if line.startswith(b"cluster ")
+    ]
+
+
+# Historie single linkage z --save-linkage (hlavicka IZPL a zaznamy
+# id1, id2, ctvercova vzdalenost, velikost) serazena podle vzdalenosti.
+LINKAGE_HEADER = struct.Struct("<4sIiiii")
+
+
+def read_linkage(path: str) -> List[tuple]:
+    with open(path, "rb") as f:
+        data = f.read()
+    n_merges = LINKAGE_HEADER.unpack_from(data)[3]
+    return [struct.unpack_from("<iifi", data, LINKAGE_HEADER.size + 16 * m) for m in range(n_merges)]
+
+
+class CutChecker:
+    """
+    Kontrola, ze rozdeleni je rez hierarchie single linkage na k shluku.
+
+    Referencni historie se spocita s --dedup, takze stejne body v ni chybi;
+    ty se slouci predem se vzdalenosti 0. Rozdeleni je platny rez ve vysce H
+    (vzdalenost posledniho slouceni, ktere rez jeste pouzije), pokud kazda
+    komponenta hran kratsich nez H lezi v jednom shluku a kazdy shluk lezi
+    v jedne komponente hran nejvyse H. Pri shodnych vzdalenostech tak projde
+    kazdy rez, ktery muze vzniknout ruznym poradim slucovani.
+    """
+
+    def __init__(self, objects: Dict[int, tuple], merges: List[tuple]):
+        self.objects = objects
+        # Stejne body jako hrany s nulovou vzdalenosti pred vsemi ostatnimi.
+        first: Dict[tuple, int] = {}
+        self.edges = []
+        for i, xy in objects.items():
+            if xy in first:
+                self.edges.append((first[xy], i, 0.0))
+            else:
+                first[xy] = i
+        self.edges += [(a, b, dist) for a, b, dist, _ in merges]
+
+    def components(self, keep) -> Dict[int, int]:
+        parent = {i: i for i in self.objects}
+
+        def find(i: int) -> int:
+            while parent[i] != i:
+                parent[i] = parent[parent[i]]
+                i = parent[i]
+            return i
+
+        for a, b, dist in self.edges:
+            if keep(dist):
+                parent[find(a)] = find(b)
+        return {i: find(i) for i in self.objects}
+
+    def valid(self, partition: List[List[int]], k: int) -> bool:
+        if len(partition) != k or sum(map(len, partition)) != len(self.objects):
+            return False
+        n_merges = len(self.objects) - k
+        if n_merges == 0:
+            return all(len(c) == 1 for c in partition)
+        height = self.edges[n_merges - 1][2]
+        below = self.components(lambda d: d < height)
+        upto = self.components(lambda d: d <= height)
+
+        label = {i: c for c, members in enumerate(partition) for i in members}
+        below_label: Dict[int, int] = {}
+        for i, root in below.items():
+            if below_label.setdefault(root, label[i]) != label[i]:
+                return False
+        return all(len({upto[i] for i in members}) == 1 for members in partition)
+
+
+def reference_checker(program: str, path: str, timeout: float) -> Optional[CutChecker]:
+    with tempfile.TemporaryDirectory() as tmp:
+        linkage = os.path.join(tmp, "reference.lnk")
+        args = [program, path, "1", "--engine=chain", "--dedup", f"--save-linkage={linkage}"]
+        try:
+            p = subprocess.run(args, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, timeout=timeout)
+        except subprocess.TimeoutExpired:
+            return None
+        if p.returncode != 0:
+            return None
+        merges = read_linkage(linkage)
+    return CutChecker(read_objects(path), merges)
+
+
+def run_engine(program: str, path: str, k: int, engine: str, timeout: float, checker: Optional[CutChecker]) -> Dict:
+    args = [program, path, str(k), "--profile"] + ENGINES[engine]["args"]
+    md5 = hashlib.md5()
+    with tempfile.TemporaryFile() as out:
+        start = time.perf_counter()
+        try:
+            p = subprocess.run(args, stdout=out, stderr=subprocess.PIPE, text=True, timeout=timeout)
+        except subprocess.TimeoutExpired:
+            return {"status": "timeout", "wall_s": timeout}
+        wall = time.perf_counter() - start
+
+        out.seek(0)
+        for chunk in iter(lambda: out.read(1 << 20), b""):
+            md5.update(chunk)
+        valid = None
+        if checker is not None and p.returncode == 0:
+            out.seek(0)
+            valid = checker.valid(parse_partition(out.read()), k)
+
+    profile = parse_profile(p.stderr)
+    if p.returncode != 0 or profile is None:
+        return {"status": f"error {p.returncode}: {p.stderr.strip()[:200]}", "wall_s": wall}
+    result = {"status": "ok", "wall_s": wall, "output_md5": md5.hexdigest(), **profile}
+    if valid is not None:
+        result["valid_cut"] = valid
+    return result
+
+
+def save_results(rows: List[Dict], prefix: str) -> None:
+    csv_path = prefix + ".csv"
+    new_file = not os.path.exists(csv_path)
+    with open(csv_path, "a", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=FIELDS, restval="")
+        if new_file:
+            writer.writeheader()
+        writer.writerows(rows)
+
+    with open(prefix + ".json", "w") as f:
+        json.dump(rows, f, indent=4)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Benchmark programu cluster")
+    parser.add_argument("program", metavar="PROGRAM", help="Cesta k programu (napriklad: ./cluster_bench)")
+    parser.add_argument("generator", metavar="GENERATOR", help="Cesta ke generatoru (napriklad: ./gen_objects)")
+    parser.add_argument("--sizes", type=int, nargs="+", default=DEFAULT_SIZES, help="Velikosti vstupu (10^2 az 10^7)")
+    parser.add_argument("--kinds", nargs="+", choices=KINDS, default=KINDS, help="Druhy dat")
+    parser.add_argument("--engines", nargs="+", choices=list(ENGINES), default=list(ENGINES), help="Enginy")
+    parser.add_argument("--clusters", type=int, default=10, help="Pozadovany pocet shluku")
+    parser.add_argument("--seed", type=int, default=2023, help="Seminko generatoru")
+    parser.add_argument("--timeout", type=float, default=600.0, help="Limit jednoho behu v sekundach")
+    parser.add_argument("--data-dir", default="bench_data", help="Adresar pro vygenerovana data")
+    parser.add_argument("--out", default="bench_results", help="Prefix vystupnich souboru .csv a .json")
+    args = parser.parse_args()
+
+    date = datetime.now(timezone.utc).isoformat(timespec="seconds")
+    commit = git_commit()
+    rows: List[Dict] = []
+    mismatches = 0
+
+    for kind in args.kinds:
+        for n in args.sizes:
+            path = dataset(args.generator, args.data_dir, kind, n, args.seed)
+            reference: Optional[str] = None
+            checker: Optional[CutChecker] = None
+            if any(ENGINES[e]["single"] and n <= ENGINES[e].get(f"max_n_{kind}", ENGINES[e]["max_n"]) for e in args.engines):
+                checker = reference_checker(args.program, path, args.timeout)
+                if checker is None:
+                    print(FAIL, f"{kind} n={n}: nepodarilo se spocitat referencni historii")
+                    mismatches += 1
+
+            for engine in args.engines:
+                info = ENGINES[engine]
+                max_n = info.get(f"max_n_{kind}", info["max_n"])
+                if n > max_n:
+                    print(SKIP, f"{kind} n={n} {engine} (limit {max_n})")
+                    continue
+
+                row = {"date": date, "commit": commit, "kind": kind, "n": n, "engine": engine}
+                row.update(run_engine(args.program, path, min(args.clusters, n), engine, args.timeout,
+                                      checker if info["single"] else None))
+
+                # Shodny vystup se jen zaznamena, pri shodnych vzdalenostech
+                # mohou enginy platne vybrat ruzne rezy.
+                if info["single"] and row["status"] == "ok":
+                    reference = reference or row["output_md5"]
+                    row["same_output"] = row["output_md5"] == reference
+                    mismatches += not row.get("valid_cut", True)
+
+                ok = row["status"] == "ok" and row.get("valid_cut", True)
+                times = " ".join(f"{key}={row[key]:.3f}" for key in ["load_s", "cluster_s", "print_s", "wall_s"] if key in row)
+                if "dist_evals" in row:
+                    times += f" dist_evals={row['dist_evals']}"
+                print(PASS if ok else FAIL, f"{kind} n={n} {engine}: {row['status']} {times}")
+                rows.append(row)
+
+    save_results(rows, args.out)
+    print(f"Vysledky: {args.out}.csv, {args.out}.json")
+    if mismatches:
+        print(FAIL, f"{mismatches} beh(u) nedalo platny rez single linkage")
+        exit(1)
@@ -4,6 +4,7 @@
  * Jednoducha shlukova analyza: 2D nejblizsi soused.
  * Single linkage
  */
+#define _POSIX_C_SOURCE 200809L // mmap, fileno
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -12,6 +13,9 @@
 #include <string.h> // memcpy
 #include <stdbool.h>
 #include <time.h> // time()
+#include <stdint.h>
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
 
 /*****************************************************************
  * Ladici makra. Vypnout jejich efekt lze definici makra
@@ -49,6 +53,8 @@
 // Maximalni hodnota souradnice za zadani.
 #define MAX_XY_VALUE 1000
 #define IN_RANGE(v) (v >= 0 && v <= MAX_XY_VALUE)
+// Vychozi velikost davky pro proudovy rezim (--stream).
+#define STREAM_BATCH_SIZE 4096
 
 /*****************************************************************
  * Deklarace potrebnych datovych typu:
@@ -75,13 +81,265 @@ struct cluster_t {
   struct obj_t *obj;
 };
 
+// Vazba shluku (--method).
+typedef enum link_kind_t {
+  LINK_SINGLE,
+  LINK_COMPLETE,
+  LINK_AVERAGE,
+  LINK_WARD,
+} LinkKind;
+
+const char *LINK_NAMES[] = { "single", "complete", "average", "ward" };
+#define N_LINK_KINDS (int)(sizeof(LINK_NAMES) / sizeof(*LINK_NAMES))
+
 // Pro prenaseni argumentu programu.
 typedef struct prg_arg_t {
   char  *filename;
   int   n_clusters;
   bool  k_means;
+  bool  stream;       // Proudovy k-means po davkach.
+  int   batch_size;   // Velikost davky pro proudovy rezim.
+  char  *kernel;      // Vynucena varianta jader vzdalenosti (NULL = podle CPU).
+  char  *convert_to;  // Prevod vstupu do binarniho formatu (NULL = neprevadet).
+  char  *linkage_out; // Ulozeni historie slucovani (NULL = neukladat).
+  char  *linkage_in;  // Rez ulozene historie misto shlukovani (NULL = shlukovat).
+  float threshold;    // Rez podle vzdalenosti (< 0 = podle poctu shluku).
+  bool  chain;        // Shlukovani metodou NN-chain misto nn_method().
+  LinkKind link_kind; // Vazba pro NN-chain.
+  int   snap;         // Krok mrizky pro slouceni stejnych bodu (0 = neslucovat).
+  bool  profile;      // Vypis casu fazi a citacu na stderr.
+  char  *snapshot_out; // Ulozeni snimku pro --update (NULL = neukladat).
+  char  *update_from;  // Pridani objektu ke snimku (NULL = shlukovat od zacatku).
 } PrgArg;
 
+/*****************************************************************
+ * Profilovani (--profile).
+ *
+ * Casy jednotlivych fazi se meri monotonnimi hodinami a scitaji se, takze
+ * faze muze byt rozdelena do vice useku (v proudovem rezimu se kazda davka
+ * pricte zvlast do cteni, shlukovani a vypisu). Faze 'neighbours' a 'merge'
+ * jsou casti faze 'cluster'. Citace pocitaji vzdalenosti dvojic objektu
+ * spocitane jadry a prohledavanim mrizky (--update), slouceni, realokace
+ * shluku a bajty presunute v remove_cluster().
+ *
+ * Mereni i citace lze vypnout definici makra NPROFILE (podobne jako NDEBUG
+ * u ladicich maker), napr. argumentem prekladaci -DNPROFILE. Makra se pak
+ * nerozvinou v nic a --profile jen oznami, ze profilovani neni prelozeno.
+ */
+typedef struct profile_t {
+  double load;        // Nacteni objektu (a slouceni stejnych bodu).
+  double cluster;     // Shlukovani vcetne rezu historie.
+  double neighbours;  // Hledani nejblizsich shluku (cast 'cluster').
+  double merge;       // Slucovani a odstranovani shluku (cast 'cluster').
+  double print;       // Vypis vysledku.
+  unsigned long long dist_evals;   // Vzdalenosti dvojic objektu spocitane jadry.
+  unsigned long long merges;       // Slouceni dvou shluku.
+  unsigned long long reallocs;     // Realokace shluku (resize_cluster() i presuny v arene).
+  unsigned long long remove_bytes; // Bajty presunute v remove_cluster().
+} Profile;
+
+Profile profile = { 0 };
+
+#ifdef NPROFILE
+#define prof_count(counter, n)
+#define prof_start(t)
+#define prof_phase(phase, t)
+#else
+
+// pricte 'n' k citaci 'counter' - pouziti prof_count(merges, 1)
+#define prof_count(counter, n) (profile.counter += (n))
+
+// zacne merit cas do nove promenne 't'
+#define prof_start(t) double t = now_sec()
+
+// pricte cas od 't' k fazi 'phase' a zacne merit dalsi fazi od ted
+#define prof_phase(phase, t) (t = phase_end(&profile.phase, t))
+
+#endif
+
+// Aktualni cas monotonnich hodin v sekundach.
+double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Pricte k fazi 'acc' cas od 'start' a vrati aktualni cas pro dalsi fazi.
+double phase_end(double *acc, double start)
+{
+  double now = now_sec();
+  *acc += now - start;
+  return now;
+}
+
+void print_profile(void)
+{
+#ifdef NPROFILE
+  fprintf(stderr, "profile: disabled (built with -DNPROFILE)\n");
+#else
+  fprintf(stderr, "profile: load=%.6f cluster=%.6f neighbours=%.6f merge=%.6f print=%.6f\n",
+          profile.load, profile.cluster, profile.neighbours, profile.merge, profile.print);
+  fprintf(stderr, "profile: dist_evals=%llu merges=%llu reallocs=%llu remove_bytes=%llu\n",
+          profile.dist_evals, profile.merges, profile.reallocs, profile.remove_bytes);
+#endif
+}
+
+/*****************************************************************
+ * Arena objektu.
+ *
+ * Objekty vsech shluku nactenych funkci load_clusters() lezi v jednom
+ * souvislem poli. Shluk je v arene jen usek [obj, obj + capacity). Pri
+ * slouceni se usek prvniho shluku bud prodlouzi na miste (lezi-li na konci
+ * arena), nebo se oba shluky zkopiruji na konec areny. Stare useky se
+ * neuvolnuji jednotlive, ale pri zaplneni areny se vsechny zive shluky
+ * zkopiruji do nove areny (kompaktace). Uvolneni vsech objektu je tak jedno
+ * volani free().
+ *
+ * Arena drzi i kopii souradnic ve sloupcich x[] a y[] se stejnymi indexy
+ * jako objekty, takze jadra vzdalenosti mohou pocitat primo nad shlukem.
+ */
+typedef struct obj_arena_t {
+  struct obj_t      *slots;
+  float             *x;
+  float             *y;
+  int               cap;
+  int               used;
+  struct cluster_t  *clusters;   // Pole shluku, jejichz objekty arena drzi.
+  int               n_clusters;
+} ObjArena;
+
+ObjArena arena = { 0 };
+
+void arena_free(void)
+{
+  free(arena.slots);
+  free(arena.x);
+  free(arena.y);
+  memset(&arena, 0, sizeof(arena));
+}
+
+// Ukazuje 'p' do areny?
+bool arena_owns(const struct obj_t *p)
+{
+  return p != NULL && arena.slots != NULL && p >= arena.slots && p < arena.slots + arena.cap;
+}
+
+// Index objektu shluku 'c' v arene.
+static inline int arena_offset(const struct cluster_t *c)
+{
+  return (int)(c->obj - arena.slots);
+}
+
+// Obnovi sloupce souradnic pro objekty shluku 'c' od indexu 'from'.
+void arena_sync(const struct cluster_t *c, int from)
+{
+  int off = arena_offset(c);
+  for (int i = from; i < c->size; i++) {
+    arena.x[off + i] = c->obj[i].x;
+    arena.y[off + i] = c->obj[i].y;
+  }
+}
+
+/*
+ Vytvori arenu pro 'n' objektu pole shluku 'carr'. Kazdy shluk dostane jeden
+ slot. Polovina areny zustava volna pro slucovani.
+*/
+bool arena_init(struct cluster_t *carr, int n)
+{
+  arena_free();
+  arena.cap = 2 * n;
+  arena.slots = (struct obj_t *)malloc(arena.cap * sizeof(*arena.slots));
+  arena.x = (float *)malloc(arena.cap * sizeof(*arena.x));
+  arena.y = (float *)malloc(arena.cap * sizeof(*arena.y));
+  CHECK(arena.slots && arena.x && arena.y, arena_free(), false, "Failed to allocate memory for object arena.");
+
+  arena.used = n;
+  arena.clusters = carr;
+  arena.n_clusters = n;
+  for (int i = 0; i < n; i++) {
+    carr[i].size = 0;
+    carr[i].capacity = 1;
+    carr[i].obj = arena.slots + i;
+  }
+  return true;
+}
+
+/*
+ Zkopiruje zive shluky v poradi pole do nove areny, ve ktere zbude misto
+ alespon pro 'extra' dalsich objektu.
+*/
+void arena_compact(int extra)
+{
+  int live = 0;
+  for (int i = 0; i < arena.n_clusters; i++)
+    if (arena_owns(arena.clusters[i].obj))
+      live += arena.clusters[i].size;
+
+  int cap = 2 * live + extra > arena.cap ? 2 * live + extra : arena.cap;
+  struct obj_t *slots = (struct obj_t *)malloc(cap * sizeof(*slots));
+  float *x = (float *)malloc(cap * sizeof(*x));
+  float *y = (float *)malloc(cap * sizeof(*y));
+  assert(slots != NULL && x != NULL && y != NULL); // Dosla pamet? :(
+
+  prof_count(reallocs, 1);
+  int used = 0;
+  for (int i = 0; i < arena.n_clusters; i++) {
+    struct cluster_t *c = arena.clusters + i;
+    if (!arena_owns(c->obj))
+      continue;
+    int off = arena_offset(c);
+    memcpy(slots + used, c->obj, c->size * sizeof(*slots));
+    memcpy(x + used, arena.x + off, c->size * sizeof(*x));
+    memcpy(y + used, arena.y + off, c->size * sizeof(*y));
+    c->obj = slots + used;
+    c->capacity = c->size;
+    used += c->size;
+  }
+
+  free(arena.slots);
+  free(arena.x);
+  free(arena.y);
+  arena.slots = slots;
+  arena.x = x;
+  arena.y = y;
+  arena.cap = cap;
+  arena.used = used;
+}
+
+/*
+ Zajisti, aby mel shluk 'c' z areny kapacitu alespon 'cap'. Shluk na konci
+ areny se prodlouzi na miste, jinak se presune na konec areny.
+*/
+void arena_reserve(struct cluster_t *c, int cap)
+{
+  assert(arena_owns(c->obj));
+  if (c->capacity >= cap)
+    return;
+
+  int off = arena_offset(c);
+  bool at_end = (off + c->capacity == arena.used);
+  if (!(at_end && off + cap <= arena.cap) && arena.used + cap > arena.cap) {
+    arena_compact(cap);
+    off = arena_offset(c);
+    at_end = (off + c->capacity == arena.used);
+  }
+
+  if (at_end && off + cap <= arena.cap) {
+    arena.used = off + cap;
+    c->capacity = cap;
+    return;
+  }
+
+  prof_count(reallocs, 1);
+  memmove(arena.slots + arena.used, c->obj, c->size * sizeof(*arena.slots));
+  memmove(arena.x + arena.used, arena.x + off, c->size * sizeof(*arena.x));
+  memmove(arena.y + arena.used, arena.y + off, c->size * sizeof(*arena.y));
+  c->obj = arena.slots + arena.used;
+  c->capacity = cap;
+  arena.used += cap;
+}
+
 /*****************************************************************
  * Deklarace potrebnych funkci.
  *
@@ -114,7 +372,8 @@ void clear_cluster(struct cluster_t *c)
   if (c->size == 0)
     return;
 
-  if (c->capacity > 0)
+  // Objekty v arene se uvolni az s celou arenou.
+  if (c->capacity > 0 && !arena_owns(c->obj))
     free(c->obj);
   init_cluster(c, 0);
 }
@@ -152,7 +411,15 @@ struct cluster_t *resize_cluster(struct cluster_t *c, int new_cap)
  */
 void append_cluster(struct cluster_t *c, struct obj_t obj)
 {
+  if (arena_owns(c->obj)) {
+    arena_reserve(c, c->size + 1);
+    c->obj[c->size++] = obj;
+    arena_sync(c, c->size - 1);
+    return;
+  }
+
   if (c->size + 1 > c->capacity) {
+    prof_count(reallocs, 1);
     if (resize_cluster(c, c->capacity + CLUSTER_CHUNK) == NULL) {
       perr("Failed to resize cluster capacity.");
       return;
@@ -176,6 +443,16 @@ void merge_clusters(struct cluster_t *c1, struct cluster_t *c2)
   assert(c1 != NULL);
   assert(c2 != NULL);
 
+  // Shluk z areny se rozsiri jen jednou o celou velikost 'c2'.
+  if (arena_owns(c1->obj)) {
+    arena_reserve(c1, c1->size + c2->size);
+    memcpy(c1->obj + c1->size, c2->obj, c2->size * sizeof(*c2->obj));
+    c1->size += c2->size;
+    sort_cluster(c1);
+    arena_sync(c1, 0);
+    return;
+  }
+
   for (int i = 0; i < c2->size; i++)
     append_cluster(c1, c2->obj[i]);
   sort_cluster(c1);
@@ -201,8 +478,10 @@ int remove_cluster(struct cluster_t *carr, int narr, int idx)
 
   // Kopiruj zbytek pole od smazaneho clusteru o jeden index bliz.
   //  - Timto nam vznikne jeden prazdny index na konci pole.
-  if (idx < narr - 1)
+  if (idx < narr - 1) {
     memmove(carr + idx, carr + idx + 1, (narr - idx - 1) * sizeof(*carr));  // Source and Dest overleap, so we have to use memmove, beacuse memcpy's behaivior is undefined.
+    prof_count(remove_bytes, (narr - idx - 1) * sizeof(*carr));
+  }
   
   // Inicializuj posledni cluster jako prazdy.
   init_cluster(carr + narr - 1, 0);
@@ -224,6 +503,327 @@ float obj_distance(struct obj_t *o1, struct obj_t *o2)
   return (float)(delta_x * delta_x + delta_y * delta_y);
 }
 
+/*****************************************************************
+ * Jadra pro vypocet vzdalenosti.
+ *
+ * Souradnice se pro vypocet prebaluji z pole 'struct obj_t' (AoS) do dvou
+ * souvislych poli x[] a y[] (SoA), nad kterymi lze pocitat vzdalenosti
+ * vektorove. Vsechna jadra vraci ctvercovou vzdalenost v presnosti float.
+ * Souradnice jsou cela cisla 0..MAX_XY_VALUE, takze vysledky jsou presne
+ * a vsechny varianty jader vraci bitove stejne hodnoty. Variantu jader
+ * vybira kernels_select() podle schopnosti procesoru.
+ */
+
+// Minimalni ctvercova vzdalenost bodu [px, py] k 'n' bodum (INFINITY pro n = 0).
+typedef float (*MinDistFun)(float px, float py, const float *x, const float *y, int n);
+// Index nejblizsiho bodu (pri shode prvni) a jeho vzdalenost do 'out_min'. Pro n = 0 vraci -1.
+typedef int (*ArgminDistFun)(float px, float py, const float *x, const float *y, int n, float *out_min);
+// Ctvercove vzdalenosti bodu [px, py] ke vsem 'n' bodum do pole 'out'.
+typedef void (*BatchDistFun)(float px, float py, const float *x, const float *y, int n, float *out);
+
+typedef struct dist_kernels_t {
+  const char    *name;
+  MinDistFun    min;
+  ArgminDistFun argmin;
+  BatchDistFun  batch;
+} DistKernels;
+
+float kern_min_scalar(float px, float py, const float *x, const float *y, int n)
+{
+  float best = INFINITY;
+  for (int i = 0; i < n; i++) {
+    float dx = x[i] - px;
+    float dy = y[i] - py;
+    float dist = dx * dx + dy * dy;
+    if (dist < best)
+      best = dist;
+  }
+  return best;
+}
+
+int kern_argmin_scalar(float px, float py, const float *x, const float *y, int n, float *out_min)
+{
+  int best_idx = -1;
+  float best = INFINITY;
+  for (int i = 0; i < n; i++) {
+    float dx = x[i] - px;
+    float dy = y[i] - py;
+    float dist = dx * dx + dy * dy;
+    if (dist < best) {
+      best = dist;
+      best_idx = i;
+    }
+  }
+  *out_min = best;
+  return best_idx;
+}
+
+void kern_batch_scalar(float px, float py, const float *x, const float *y, int n, float *out)
+{
+  for (int i = 0; i < n; i++) {
+    float dx = x[i] - px;
+    float dy = y[i] - py;
+    out[i] = dx * dx + dy * dy;
+  }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+
+/*
+ Slouci vysledky z jednotlivych drah vektoru s vysledkem skalarniho zbytku.
+ Pri shode vzdalenosti vyhrava mensi index, aby vysledek odpovidal skalarni
+ variante.
+*/
+int kern_reduce_lanes(const float *dist, const int *idx, int lanes, float *out_min)
+{
+  int best_idx = -1;
+  float best = INFINITY;
+  for (int l = 0; l < lanes; l++)
+    if (dist[l] < best || (dist[l] == best && best_idx >= 0 && idx[l] < best_idx)) {
+      best = dist[l];
+      best_idx = idx[l];
+    }
+  *out_min = best;
+  return best_idx;
+}
+
+__attribute__((target("sse2")))
+float kern_min_sse2(float px, float py, const float *x, const float *y, int n)
+{
+  __m128 vpx = _mm_set1_ps(px), vpy = _mm_set1_ps(py);
+  __m128 vbest = _mm_set1_ps(INFINITY);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), vpx);
+    __m128 dy = _mm_sub_ps(_mm_loadu_ps(y + i), vpy);
+    vbest = _mm_min_ps(vbest, _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, vbest);
+  float best = kern_min_scalar(px, py, x + i, y + i, n - i);
+  for (int l = 0; l < 4; l++)
+    best = lanes[l] < best ? lanes[l] : best;
+  return best;
+}
+
+__attribute__((target("sse2")))
+int kern_argmin_sse2(float px, float py, const float *x, const float *y, int n, float *out_min)
+{
+  __m128 vpx = _mm_set1_ps(px), vpy = _mm_set1_ps(py);
+  __m128 vbest = _mm_set1_ps(INFINITY);
+  __m128i vidx = _mm_setr_epi32(0, 1, 2, 3), vbest_idx = _mm_set1_epi32(-1);
+  const __m128i vstep = _mm_set1_epi32(4);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), vpx);
+    __m128 dy = _mm_sub_ps(_mm_loadu_ps(y + i), vpy);
+    __m128 dist = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+    // SSE2 nema blend, proto vybirame pres masku.
+    __m128 mask = _mm_cmplt_ps(dist, vbest);
+    __m128i imask = _mm_castps_si128(mask);
+    vbest = _mm_or_ps(_mm_and_ps(mask, dist), _mm_andnot_ps(mask, vbest));
+    vbest_idx = _mm_or_si128(_mm_and_si128(imask, vidx), _mm_andnot_si128(imask, vbest_idx));
+    vidx = _mm_add_epi32(vidx, vstep);
+  }
+  float dist[5];
+  int idx[5];
+  _mm_storeu_ps(dist, vbest);
+  _mm_storeu_si128((__m128i *)idx, vbest_idx);
+  idx[4] = kern_argmin_scalar(px, py, x + i, y + i, n - i, dist + 4);
+  if (idx[4] >= 0)
+    idx[4] += i;
+  return kern_reduce_lanes(dist, idx, 5, out_min);
+}
+
+__attribute__((target("sse2")))
+void kern_batch_sse2(float px, float py, const float *x, const float *y, int n, float *out)
+{
+  __m128 vpx = _mm_set1_ps(px), vpy = _mm_set1_ps(py);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), vpx);
+    __m128 dy = _mm_sub_ps(_mm_loadu_ps(y + i), vpy);
+    _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+  }
+  kern_batch_scalar(px, py, x + i, y + i, n - i, out + i);
+}
+
+__attribute__((target("avx2")))
+float kern_min_avx2(float px, float py, const float *x, const float *y, int n)
+{
+  __m256 vpx = _mm256_set1_ps(px), vpy = _mm256_set1_ps(py);
+  __m256 vbest = _mm256_set1_ps(INFINITY);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + i), vpx);
+    __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y + i), vpy);
+    vbest = _mm256_min_ps(vbest, _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+  }
+  float lanes[8];
+  _mm256_storeu_ps(lanes, vbest);
+  float best = kern_min_scalar(px, py, x + i, y + i, n - i);
+  for (int l = 0; l < 8; l++)
+    best = lanes[l] < best ? lanes[l] : best;
+  return best;
+}
+
+__attribute__((target("avx2")))
+int kern_argmin_avx2(float px, float py, const float *x, const float *y, int n, float *out_min)
+{
+  __m256 vpx = _mm256_set1_ps(px), vpy = _mm256_set1_ps(py);
+  __m256 vbest = _mm256_set1_ps(INFINITY);
+  __m256i vidx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), vbest_idx = _mm256_set1_epi32(-1);
+  const __m256i vstep = _mm256_set1_epi32(8);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + i), vpx);
+    __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y + i), vpy);
+    __m256 dist = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+    __m256 mask = _mm256_cmp_ps(dist, vbest, _CMP_LT_OQ);
+    vbest = _mm256_blendv_ps(vbest, dist, mask);
+    vbest_idx = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(vbest_idx), _mm256_castsi256_ps(vidx), mask));
+    vidx = _mm256_add_epi32(vidx, vstep);
+  }
+  float dist[9];
+  int idx[9];
+  _mm256_storeu_ps(dist, vbest);
+  _mm256_storeu_si256((__m256i *)idx, vbest_idx);
+  idx[8] = kern_argmin_scalar(px, py, x + i, y + i, n - i, dist + 8);
+  if (idx[8] >= 0)
+    idx[8] += i;
+  return kern_reduce_lanes(dist, idx, 9, out_min);
+}
+
+__attribute__((target("avx2")))
+void kern_batch_avx2(float px, float py, const float *x, const float *y, int n, float *out)
+{
+  __m256 vpx = _mm256_set1_ps(px), vpy = _mm256_set1_ps(py);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + i), vpx);
+    __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y + i), vpy);
+    _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+  }
+  kern_batch_scalar(px, py, x + i, y + i, n - i, out + i);
+}
+#endif
+
+// Dostupne varianty jader serazene od nejpomalejsi.
+const DistKernels KERNELS[] = {
+  { "scalar", kern_min_scalar, kern_argmin_scalar, kern_batch_scalar },
+#ifdef HAVE_X86_KERNELS
+  { "sse2",   kern_min_sse2,   kern_argmin_sse2,   kern_batch_sse2 },
+  { "avx2",   kern_min_avx2,   kern_argmin_avx2,   kern_batch_avx2 },
+#endif
+};
+#define N_KERNELS (int)(sizeof(KERNELS) / sizeof(*KERNELS))
+
+// Prave pouzivana jadra.
+const DistKernels *kern = &KERNELS[0];
+
+// Zjisti, jestli procesor podporuje danou variantu jader.
+bool kernels_supported(const DistKernels *k)
+{
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if (strcmp(k->name, "sse2") == 0)
+    return __builtin_cpu_supports("sse2");
+  if (strcmp(k->name, "avx2") == 0)
+    return __builtin_cpu_supports("avx2");
+#endif
+  return strcmp(k->name, "scalar") == 0;
+}
+
+/*
+ Vybere variantu jader podle jmena. Pro 'name' == NULL vybere nejrychlejsi
+ variantu, kterou procesor podporuje. Vraci false, pokud varianta neexistuje
+ nebo ji procesor nepodporuje.
+*/
+bool kernels_select(const char *name)
+{
+  for (int i = N_KERNELS - 1; i >= 0; i--) {
+    if (name != NULL && strcmp(name, KERNELS[i].name) != 0)
+      continue;
+    if (kernels_supported(KERNELS + i)) {
+      kern = KERNELS + i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ Souradnice shluku prebalene do SoA. Objekty shluku 'i' lezi na indexech
+ start[i] az start[i + 1] - 1, owner[k] je index shluku objektu 'k'.
+*/
+typedef struct packed_clusters_t {
+  int   n_obj;
+  int   obj_cap;
+  int   n_clusters;
+  int   cluster_cap;
+  float *x;
+  float *y;
+  int   *owner;
+  int   *start;
+} PackedClusters;
+
+// Pomocny buffer pro prebalovani. Uvolnuje se funkci packed_free().
+PackedClusters packed = { 0 };
+
+void packed_free(void)
+{
+  free(packed.x);
+  free(packed.y);
+  free(packed.owner);
+  free(packed.start);
+  memset(&packed, 0, sizeof(packed));
+}
+
+/*
+ Prebali souradnice 'narr' shluku z pole 'carr' do bufferu 'packed'.
+*/
+void pack_clusters(struct cluster_t *carr, int narr)
+{
+  int n_obj = 0;
+  for (int i = 0; i < narr; i++)
+    n_obj += carr[i].size;
+
+  if (n_obj > packed.obj_cap) {
+    packed.x = (float *)realloc(packed.x, n_obj * sizeof(*packed.x));
+    packed.y = (float *)realloc(packed.y, n_obj * sizeof(*packed.y));
+    packed.owner = (int *)realloc(packed.owner, n_obj * sizeof(*packed.owner));
+    assert(packed.x != NULL && packed.y != NULL && packed.owner != NULL); // Dosla pamet? :(
+    packed.obj_cap = n_obj;
+  }
+  if (narr + 1 > packed.cluster_cap) {
+    packed.start = (int *)realloc(packed.start, (narr + 1) * sizeof(*packed.start));
+    assert(packed.start != NULL); // Dosla pamet? :(
+    packed.cluster_cap = narr + 1;
+  }
+
+  int k = 0;
+  for (int i = 0; i < narr; i++) {
+    packed.start[i] = k;
+    // Shluky z areny uz souradnice ve sloupcich maji.
+    if (arena_owns(carr[i].obj)) {
+      memcpy(packed.x + k, arena.x + arena_offset(carr + i), carr[i].size * sizeof(*packed.x));
+      memcpy(packed.y + k, arena.y + arena_offset(carr + i), carr[i].size * sizeof(*packed.y));
+    }
+    for (int j = 0; j < carr[i].size; j++, k++) {
+      if (!arena_owns(carr[i].obj)) {
+        packed.x[k] = carr[i].obj[j].x;
+        packed.y[k] = carr[i].obj[j].y;
+      }
+      packed.owner[k] = i;
+    }
+  }
+  packed.start[narr] = k;
+  packed.n_obj = n_obj;
+  packed.n_clusters = narr;
+}
+
 /*
  Pocita vzdalenost dvou shluku.
 */
@@ -234,15 +834,22 @@ float cluster_distance(struct cluster_t *c1, struct cluster_t *c2)
   assert(c2 != NULL);
   assert(c2->size > 0);
 
-  // Pozor! Funkce obj_distance vraci ctvercovou vyzdalenost (obsah cverce nad preponou)
-  float min_dist = (MAX_XY_VALUE * MAX_XY_VALUE) + 1;
+  // Pozor! Jadra vraci ctvercovou vyzdalenost (obsah cverce nad preponou)
+  const float *x2 = NULL, *y2 = NULL;
+  if (arena_owns(c2->obj)) {
+    x2 = arena.x + arena_offset(c2);
+    y2 = arena.y + arena_offset(c2);
+  } else {
+    pack_clusters(c2, 1);
+    x2 = packed.x;
+    y2 = packed.y;
+  }
 
   // Najdeme nejmensi vzdalenost mezi vsemy elementy dvou clusteru.
+  float min_dist = INFINITY;
+  prof_count(dist_evals, (unsigned long long)c1->size * c2->size);
   for (int i = 0; i < c1->size; i++)
-    for (int j = 0; j < c2->size; j++) {
-      float dist = obj_distance(c1->obj + i, c2->obj + j);
-      min_dist = fmin(min_dist, dist);
-    }
+    min_dist = fmin(min_dist, kern->min(c1->obj[i].x, c1->obj[i].y, x2, y2, c2->size));
 
   return min_dist;
 }
@@ -264,12 +871,20 @@ void find_neighbours(struct cluster_t *carr, int narr, int *c1, int *c2)
   }
 
   *c1 = 0; *c2 = 1;
-  float min_dist = (MAX_XY_VALUE * MAX_XY_VALUE) + 1, dist = 0.0f;
-
-  for (int i = 0; i < narr; i++) {
-    for (int j = i + 1; j < narr; j++) {
-      dist = cluster_distance(carr + i, carr + j);
-      if (dist < min_dist) {
+  float min_dist = INFINITY, dist = 0.0f;
+
+  // Vzdalenost shluku je nejmensi vzdalenost jejich objektu, proto staci pro
+  // kazdy objekt najit nejblizsi objekt ze vsech nasledujicich shluku naraz.
+  // Pri shode vyhrava dvojice s nejmensim (i, j) stejne jako pri postupnem
+  // porovnavani dvojic shluku.
+  pack_clusters(carr, narr);
+  for (int i = 0; i < narr - 1; i++) {
+    int rest = packed.start[i + 1];
+    for (int a = packed.start[i]; a < rest; a++) {
+      int b = kern->argmin(packed.x[a], packed.y[a], packed.x + rest, packed.y + rest, packed.n_obj - rest, &dist);
+      prof_count(dist_evals, packed.n_obj - rest);
+      int j = packed.owner[rest + b];
+      if (dist < min_dist || (dist == min_dist && i == *c1 && j < *c2)) {
         *c1 = i;
         *c2 = j;
         min_dist = dist;
@@ -320,135 +935,1873 @@ void delete_clusters(struct cluster_t **arr, int n_clusters)
   // Uvolni pamet alokovanou shlukem objektu.
   for (int i = 0; i < n_clusters; i++) 
     clear_cluster(*arr + i);
+  if (arena.clusters == *arr)
+    arena_free();
 
   free(*arr);
   *arr = NULL;
 }
 
-void load_cleanup(struct cluster_t **arr, int narr, FILE *fd)
-{
-  if (*arr != NULL)
-    delete_clusters(arr, narr);
-  fclose(fd);
-} 
-bool is_unique_id(int id, struct cluster_t *arr, int first_n_elements)
-{
-  for (int i = 0; i < first_n_elements; i++)
-    for (int j = 0; j < arr[i].size; j++)
-      if (id == arr[i].obj[j].id)
-        return false;
-  return true;
-}
+/*****************************************************************
+ * Sekvencni cteni objektu ze souboru.
+ *
+ * Ctecka zkontroluje hlavicku 'count=N' pri otevreni a pote vraci objekty
+ * jeden po druhem. Kazdy radek je zkontrolovan na format a rozsah souradnic.
+ * Kontrola unikatnosti ID je na volajicim, protoze ctecka si nepamatuje
+ * uz prectene objekty.
+ *
+ * Soubor se cte po blocich do bufferu a cisla se parsuji rucne. Parser
+ * prijima stejny vstup jako puvodni fscanf("%i %i %i%c"): bile znaky pred
+ * cislem se preskakuji, cislo muze mit znamenko a prefix 0x/0 (sestnactkove
+ * a osmickove cislo) a radek musi koncit znakem '\n' hned za posledni
+ * souradnici.
+ */
+#define READER_BUF_SIZE (64 * 1024)
+
 /*
- Ze souboru 'filename' nacte objekty. Pro kazdy objekt vytvori shluk a ulozi
- jej do pole shluku. Alokuje prostor pro pole vsech shluku a ukazatel na prvni
- polozku pole (ukalazatel na prvni shluk v alokovanem poli) ulozi do pameti,
- kam se odkazuje parametr 'arr'. Funkce vraci pocet nactenych objektu (shluku).
- V pripade nejake chyby uklada do pameti, kam se odkazuje 'arr', hodnotu NULL.
+ Binarni format objektu (vytvari ho prepinac --convert). Za hlavickou
+ nasleduji sloupce int32 ID[count], int16 X[count] a int16 Y[count]
+ v nativnim poradi bajtu. Soubor se namapuje do pameti a misto parsovani
+ se jen projdou souradnice (meze z hlavicky) a ID (load_clusters()).
 */
-int load_clusters(char *filename, struct cluster_t **arr)
+#define BIN_MAGIC "IZPC"
+#define BIN_VERSION 1
+
+typedef struct bin_header_t {
+  char      magic[4];
+  uint32_t  version;
+  int32_t   count;
+  int16_t   min_x;
+  int16_t   min_y;
+  int16_t   max_x;
+  int16_t   max_y;
+  uint32_t  reserved[3];
+} BinHeader;
+
+typedef struct obj_reader_t {
+  FILE    *fd;
+  int     n_total;  // Pocet objektu podle hlavicky 'count='.
+  int     n_read;   // Pocet doposud prectenych objektu.
+  char    *buf;     // Blok prave cteneho souboru.
+  size_t  pos;      // Pozice dalsiho znaku v bufferu.
+  size_t  len;      // Pocet platnych znaku v bufferu.
+  // Namapovany binarni soubor (map == NULL pro textovy soubor).
+  void          *map;
+  size_t        map_size;
+  const int32_t *ids;
+  const int16_t *xs;
+  const int16_t *ys;
+} ObjReader;
+
+void reader_close(ObjReader *r)
 {
-  assert(arr != NULL);
-  *arr = NULL;
+  if (r->fd != NULL)
+    fclose(r->fd);
+  if (r->map != NULL)
+    munmap(r->map, r->map_size);
+  free(r->buf);
+  r->fd = NULL;
+  r->buf = NULL;
+  r->map = NULL;
+}
 
-  FILE* fd = fopen(filename, "r");
-  if (!fd) {
-    *arr = NULL;
-    perr("Failed to open file '%s' for reading.", filename);
-    return 0;
+// Vrati dalsi znak bez jeho precteni nebo EOF na konci souboru.
+static inline int reader_peek(ObjReader *r)
+{
+  if (r->pos == r->len) {
+    r->len = fread(r->buf, 1, READER_BUF_SIZE, r->fd);
+    r->pos = 0;
+    if (r->len == 0)
+      return EOF;
   }
+  return (unsigned char)r->buf[r->pos];
+}
 
-  // Nacteni poctu objektu ke cteni.
-  char last_char = 0;
-  int n_obj = 0;
-  int count_scanned = fscanf(fd, "count=%i%c", &n_obj, &last_char);
-  CHECK(count_scanned != 0 && last_char == '\n', load_cleanup(arr, 0, fd), 0, "Count parameter is in invalid format.");
-  CHECK(n_obj > 0, load_cleanup(arr, 0, fd), 0, "Invalid number of rows passed (%i).", n_obj);
+// Vrati a precte dalsi znak nebo EOF na konci souboru.
+static inline int reader_getc(ObjReader *r)
+{
+  int c = reader_peek(r);
+  if (c != EOF)
+    r->pos++;
+  return c;
+}
 
-  // Alokovani pameti pro vsechny clustery. Ke smazani je funkce delete_clusters().
-  *arr = (struct cluster_t *)malloc(n_obj * sizeof(**arr));
-  CHECK(*arr != NULL, load_cleanup(arr, 0, fd), 0, "Failed to allocate memory for cluster array.");
-  memset(*arr, 0, n_obj * sizeof(**arr));
-  
-  // Nacteni vsech bodu radek po radku.
-  int obj_id = 0, obj_x = 0, obj_y = 0;
-  for (int i = 0; i < n_obj; i++)
-  {
-    int n_scanned = fscanf(fd, "%i %i %i%c", &obj_id, &obj_x, &obj_y, &last_char);
+// Hodnota cislice 'c' v soustave 'base' nebo -1, pokud to cislice neni.
+static inline int digit_value(int c, int base)
+{
+  int v = -1;
+  if (c >= '0' && c <= '9')
+    v = c - '0';
+  else if (c >= 'a' && c <= 'f')
+    v = c - 'a' + 10;
+  else if (c >= 'A' && c <= 'F')
+    v = c - 'A' + 10;
+  return v < base ? v : -1;
+}
+
+/*
+ Precte cele cislo ve formatu '%i'. Vraci false, pokud na vstupu neni cislo
+ nebo se cislo nevejde do typu int.
+*/
+bool reader_int(ObjReader *r, int *out)
+{
+  int c;
+  while ((c = reader_peek(r)) == ' ' || (c >= '\t' && c <= '\r'))
+    r->pos++;
+
+  bool negative = false;
+  if (c == '+' || c == '-') {
+    negative = (c == '-');
+    r->pos++;
+  }
 
-    // Kontrola poctu nactenych cisel v jedne radce.
-    CHECK(n_scanned == 4 && last_char == '\n', load_cleanup(arr, n_obj, fd), 0, "Invalid row format.");
-    // Kontrola rozsahu souradnic
-    CHECK(IN_RANGE(obj_x) && IN_RANGE(obj_y), load_cleanup(arr, n_obj, fd), 0, "Object coordinates are out of range. OBJID = %i, X = %i, Y = %i\n", obj_id, obj_x, obj_y);
-    // Kontrola unikatniho ID
-    CHECK(is_unique_id(obj_id, *arr, i), load_cleanup(arr, n_obj, fd), 0, "ID is not unique! ID = %i", obj_id);
+  int base = 10;
+  bool any_digit = false;
+  if (reader_peek(r) == '0') {
+    r->pos++;
+    any_digit = true;
+    base = 8;
+    c = reader_peek(r);
+    if (c == 'x' || c == 'X') {
+      r->pos++;
+      base = 16;
+    }
+  }
 
-    init_cluster(*arr + i, CLUSTER_CHUNK);
-    (*arr)[i].size = 1;
-    (*arr)[i].obj->id = obj_id;
-    (*arr)[i].obj->x = obj_x;
-    (*arr)[i].obj->y = obj_y;
+  long long value = 0;
+  int d;
+  while ((c = reader_peek(r)) != EOF && (d = digit_value(c, base)) >= 0) {
+    value = value * base + d;
+    if (value > (long long)INT_MAX + 1)
+      return false;
+    any_digit = true;
+    r->pos++;
   }
 
-  fclose(fd);
-  return n_obj;
+  value = negative ? -value : value;
+  if (!any_digit || value > INT_MAX || value < INT_MIN)
+    return false;
+  *out = (int)value;
+  return true;
 }
 
 /*
- Tisk pole shluku. Parametr 'carr' je ukazatel na prvni polozku (shluk).
- Tiskne se prvnich 'narr' shluku.
+ Namapuje binarni soubor otevreny v 'r->fd' do pameti. Kontroluje se hlavicka,
+ velikost souboru a to, ze vsechny souradnice lezi v mezich z hlavicky, ktere
+ musi byt v rozsahu zadani. Unikatnost ID kontroluje az load_clusters().
 */
-void print_clusters(struct cluster_t *carr, int narr)
+bool reader_open_binary(ObjReader *r, const char *filename)
 {
-  printf("Clusters:\n");
-  for (int i = 0; i < narr; i++)
-  {
-      printf("cluster %d: ", i);
-      print_cluster(&carr[i]);
+  struct stat st;
+  CHECK(fstat(fileno(r->fd), &st) == 0 && (size_t)st.st_size >= sizeof(BinHeader), reader_close(r), false, "Binary object file '%s' is corrupted.", filename);
+
+  r->map_size = (size_t)st.st_size;
+  r->map = mmap(NULL, r->map_size, PROT_READ, MAP_PRIVATE, fileno(r->fd), 0);
+  if (r->map == MAP_FAILED)
+    r->map = NULL;
+  CHECK(r->map != NULL, reader_close(r), false, "Failed to map file '%s' to memory.", filename);
+  // Mapovani zustava platne i po zavreni souboru.
+  fclose(r->fd);
+  r->fd = NULL;
+
+  const BinHeader *h = (const BinHeader *)r->map;
+  size_t expected = sizeof(BinHeader) + (size_t)(h->count > 0 ? h->count : 0) * (sizeof(int32_t) + 2 * sizeof(int16_t));
+  CHECK(h->version == BIN_VERSION && h->count > 0 && r->map_size == expected, reader_close(r), false, "Binary object file '%s' is corrupted.", filename);
+  bool bounds_ok = IN_RANGE(h->min_x) && IN_RANGE(h->min_y) && IN_RANGE(h->max_x) && IN_RANGE(h->max_y)
+                && h->min_x <= h->max_x && h->min_y <= h->max_y;
+  CHECK(bounds_ok, reader_close(r), false, "Binary object file '%s' has invalid coordinate bounds.", filename);
+
+  r->n_total = h->count;
+  r->ids = (const int32_t *)(h + 1);
+  r->xs = (const int16_t *)(r->ids + h->count);
+  r->ys = r->xs + h->count;
+
+  // Soubor nemusel vzniknout prevodem, proto se souradnice projdou vsechny.
+  for (int i = 0; i < r->n_total; i++) {
+    bool in_bounds = r->xs[i] >= h->min_x && r->xs[i] <= h->max_x && r->ys[i] >= h->min_y && r->ys[i] <= h->max_y;
+    CHECK(in_bounds, reader_close(r), false, "Object coordinates are out of range. OBJID = %i, X = %i, Y = %i\n", r->ids[i], r->xs[i], r->ys[i]);
   }
+  return true;
 }
 
-bool parse_arguments(int argc, char **argv, PrgArg *args)
+/*
+ Otevre soubor 'filename' a nacte z nej pocet objektu. Pri chybe vypise hlasku
+ a vrati false.
+*/
+bool reader_open(ObjReader *r, const char *filename)
 {
-  // Brzky exit.
-  if (argc == 1 || argc > 4)
-    return false;
-
-  // Parsni filename a cluster count.
-  args->filename = argv[1];
-  if (argc >= 3) {
-    char *perr = NULL;
-    args->n_clusters = (int)strtol(argv[2], &perr, 10);
+  memset(r, 0, sizeof(*r));
+  r->fd = fopen(filename, "r");
+  CHECK(r->fd != NULL, (void)0, false, "Failed to open file '%s' for reading.", filename);
 
-    if (*perr != '\0' || args->n_clusters < 1)
-      return false;
-  } else {
-    args->n_clusters = 1;
-  }
+  r->buf = (char *)malloc(READER_BUF_SIZE);
+  CHECK(r->buf != NULL, reader_close(r), false, "Failed to allocate memory for file buffer.");
 
-  // Zkontroluj flag -k.
-  args->k_means = (argc == 4 && strcmp("-k", argv[3]) == 0);
+  // Binarni soubor se pozna podle magicke hlavicky v prvnim bloku. Blok
+  // zustava v bufferu, takze funguje i cteni z roury.
+  reader_peek(r);
+  if (r->len >= sizeof(BIN_MAGIC) - 1 && memcmp(r->buf, BIN_MAGIC, sizeof(BIN_MAGIC) - 1) == 0)
+    return reader_open_binary(r, filename);
 
-  return args->k_means || argc != 4;
+  // Nacteni poctu objektu ke cteni.
+  bool header_ok = true;
+  for (const char *p = "count="; *p != '\0' && header_ok; p++)
+    header_ok = (reader_getc(r) == *p);
+  header_ok = header_ok && reader_int(r, &r->n_total) && reader_getc(r) == '\n';
+  CHECK(header_ok, reader_close(r), false, "Count parameter is in invalid format.");
+  CHECK(r->n_total > 0, reader_close(r), false, "Invalid number of rows passed (%i).", r->n_total);
+  return true;
 }
 
-// Metoda nejblizsiho souseda pro shlukovani clusteru.
-void nn_method(struct cluster_t *clusters, int narr, int n_wanted_clusters)
+/*
+ Precte dalsi objekt do 'obj'. Vraci 1 pri uspechu, 0 pokud uz byly precteny
+ vsechny objekty z hlavicky a -1 pri chybe (hlaska je jiz vypsana).
+*/
+int reader_next(ObjReader *r, struct obj_t *obj)
 {
-  // Ze zacatku jsou vsechny clustery ve svem clusteru.
-  int n_clusters = narr, c1, c2;
-  while (n_clusters > n_wanted_clusters) {
-    // Najdi dva nejbizsi clustery.
-    find_neighbours(clusters, n_clusters, &c1, &c2);
-    // Sluc druhy cluster do prvniho.
-    merge_clusters(clusters + c1, clusters + c2);
-    // Odstran druhy cluster, protoze ho uz nepotrebujeme.
-    n_clusters = remove_cluster(clusters, n_clusters, c2);
+  if (r->n_read >= r->n_total)
+    return 0;
+
+  if (r->map != NULL) {
+    obj->id = r->ids[r->n_read];
+    obj->x = r->xs[r->n_read];
+    obj->y = r->ys[r->n_read];
+    r->n_read++;
+    return 1;
   }
+
+  int obj_id = 0, obj_x = 0, obj_y = 0;
+  bool row_ok = reader_int(r, &obj_id) && reader_int(r, &obj_x) && reader_int(r, &obj_y) && reader_getc(r) == '\n';
+
+  // Kontrola poctu nactenych cisel v jedne radce.
+  CHECK(row_ok, (void)0, -1, "Invalid row format.");
+  // Kontrola rozsahu souradnic
+  CHECK(IN_RANGE(obj_x) && IN_RANGE(obj_y), (void)0, -1, "Object coordinates are out of range. OBJID = %i, X = %i, Y = %i\n", obj_id, obj_x, obj_y);
+
+  obj->id = obj_id;
+  obj->x = obj_x;
+  obj->y = obj_y;
+  r->n_read++;
+  return 1;
 }
 
-// Get index of the nearest centroid to point.
-int main(int argc, char *argv[])
+/*
+ Precte az 'max' dalsich objektu do pole 'batch'. Vraci pocet prectenych
+ objektu (0 pokud uz zadne nezbyvaji) nebo -1 pri chybe.
+*/
+int reader_next_batch(ObjReader *r, struct obj_t *batch, int max)
+{
+  int n = 0, status = 0;
+  while (n < max && (status = reader_next(r, batch + n)) == 1)
+    n++;
+  return status < 0 ? -1 : n;
+}
+
+/*****************************************************************
+ * Hashovaci tabulka ID objektu -> index objektu.
+ *
+ * Otevrene adresovani s linearnim probirkovanim. Kapacita je mocnina dvou
+ * alespon dvojnasobna oproti poctu klicu, takze tabulka nikdy neni plna
+ * a nemusi se zvetsovat.
+ */
+typedef struct id_map_t {
+  unsigned  mask;   // Kapacita - 1.
+  unsigned  shift;  // 32 - log2(kapacita).
+  int       *keys;
+  int       *values; // -1 znamena prazdny slot.
+} IdMap;
+
+void id_map_free(IdMap *m)
+{
+  free(m->keys);
+  free(m->values);
+  m->keys = m->values = NULL;
+}
+
+// Pripravi tabulku pro 'n' klicu. Vraci false, pokud dosla pamet.
+bool id_map_init(IdMap *m, int n)
+{
+  unsigned cap = 16;
+  m->shift = 28;
+  while (cap < 2u * (unsigned)n) {
+    cap <<= 1;
+    m->shift--;
+  }
+  m->mask = cap - 1;
+  m->keys = (int *)malloc(cap * sizeof(*m->keys));
+  m->values = (int *)malloc(cap * sizeof(*m->values));
+  CHECK(m->keys != NULL && m->values != NULL, id_map_free(m), false, "Failed to allocate memory for ID table.");
+  memset(m->values, -1, cap * sizeof(*m->values));
+  return true;
+}
+
+// Index slotu, kde je klic 'id' nebo kam by mel byt vlozen.
+static inline unsigned id_map_slot(const IdMap *m, int id)
+{
+  // Fibonacciho hashovani: slot tvori horni bity soucinu, ktere zavisi na
+  // vsech bitech ID. Dolni bity by zavisely jen na dolnich bitech ID, takze
+  // napr. vsechna ID tvaru i << 16 by zacinala ve stejnem slotu.
+  unsigned slot = (uint32_t)((uint32_t)id * 2654435769u) >> m->shift;
+  while (m->values[slot] >= 0 && m->keys[slot] != id)
+    slot = (slot + 1) & m->mask;
+  return slot;
+}
+
+// Vlozi dvojici 'id' -> 'value'. Vraci false, pokud uz 'id' v tabulce je.
+bool id_map_insert(IdMap *m, int id, int value)
+{
+  unsigned slot = id_map_slot(m, id);
+  if (m->values[slot] >= 0)
+    return false;
+  m->keys[slot] = id;
+  m->values[slot] = value;
+  return true;
+}
+
+// Vrati hodnotu pro 'id' nebo -1, pokud v tabulce neni.
+int id_map_get(const IdMap *m, int id)
+{
+  return m->values[id_map_slot(m, id)];
+}
+
+void load_cleanup(struct cluster_t **arr, int narr, ObjReader *reader, IdMap *ids)
+{
+  if (*arr != NULL)
+    delete_clusters(arr, narr);
+  reader_close(reader);
+  id_map_free(ids);
+}
+
+/*
+ Ze souboru 'filename' nacte objekty. Pro kazdy objekt vytvori shluk a ulozi
+ jej do pole shluku. Alokuje prostor pro pole vsech shluku a ukazatel na prvni
+ polozku pole (ukalazatel na prvni shluk v alokovanem poli) ulozi do pameti,
+ kam se odkazuje parametr 'arr'. Funkce vraci pocet nactenych objektu (shluku).
+ V pripade nejake chyby uklada do pameti, kam se odkazuje 'arr', hodnotu NULL.
+*/
+int load_clusters(char *filename, struct cluster_t **arr)
+{
+  assert(arr != NULL);
+  *arr = NULL;
+
+  ObjReader reader;
+  IdMap ids = { 0 };
+  if (!reader_open(&reader, filename))
+    return 0;
+  int n_obj = reader.n_total;
+
+  // Alokovani pameti pro vsechny clustery. Ke smazani je funkce delete_clusters().
+  *arr = (struct cluster_t *)malloc(n_obj * sizeof(**arr));
+  CHECK(*arr != NULL, load_cleanup(arr, 0, &reader, &ids), 0, "Failed to allocate memory for cluster array.");
+  memset(*arr, 0, n_obj * sizeof(**arr));
+  if (!id_map_init(&ids, n_obj) || !arena_init(*arr, n_obj)) {
+    load_cleanup(arr, n_obj, &reader, &ids);
+    return 0;
+  }
+  
+  // Nacteni vsech bodu radek po radku.
+  struct obj_t obj;
+  for (int i = 0; i < n_obj; i++)
+  {
+    // Chybu formatu nebo rozsahu uz vypsala ctecka.
+    if (reader_next(&reader, &obj) != 1) {
+      load_cleanup(arr, n_obj, &reader, &ids);
+      return 0;
+    }
+    // Kontrola unikatniho ID. I binarni soubor mohl vzniknout jinak nez prevodem.
+    CHECK(id_map_insert(&ids, obj.id, i), load_cleanup(arr, n_obj, &reader, &ids), 0, "ID is not unique! ID = %i", obj.id);
+
+    // Shluk uz ma v arene pripraveny jeden slot.
+    append_cluster(*arr + i, obj);
+  }
+
+  reader_close(&reader);
+  id_map_free(&ids);
+  return n_obj;
+}
+
+void convert_cleanup(ObjReader *reader, IdMap *ids, int32_t *ids_col, int16_t *xs, int16_t *ys)
+{
+  reader_close(reader);
+  id_map_free(ids);
+  free(ids_col);
+  free(xs);
+  free(ys);
+}
+
+/*
+ Prevede objekty ze souboru 'in_filename' do binarniho formatu a ulozi je do
+ 'out_filename'. Vstup se pri tom kontroluje stejne jako v load_clusters().
+*/
+bool convert_objects(const char *in_filename, const char *out_filename)
+{
+  ObjReader reader;
+  IdMap ids = { 0 };
+  if (!reader_open(&reader, in_filename))
+    return false;
+  int n = reader.n_total;
+
+  int32_t *ids_col = (int32_t *)malloc(n * sizeof(*ids_col));
+  int16_t *xs = (int16_t *)malloc(n * sizeof(*xs));
+  int16_t *ys = (int16_t *)malloc(n * sizeof(*ys));
+  CHECK(ids_col && xs && ys, convert_cleanup(&reader, &ids, ids_col, xs, ys), false, "Failed to allocate memory for object columns.");
+  if (!id_map_init(&ids, n)) {
+    convert_cleanup(&reader, &ids, ids_col, xs, ys);
+    return false;
+  }
+
+  BinHeader h = { .version = BIN_VERSION, .count = n,
+                  .min_x = MAX_XY_VALUE, .min_y = MAX_XY_VALUE, .max_x = 0, .max_y = 0 };
+  memcpy(h.magic, BIN_MAGIC, sizeof(h.magic));
+  struct obj_t obj;
+  for (int i = 0; i < n; i++) {
+    if (reader_next(&reader, &obj) != 1) {
+      convert_cleanup(&reader, &ids, ids_col, xs, ys);
+      return false;
+    }
+    CHECK(id_map_insert(&ids, obj.id, i), convert_cleanup(&reader, &ids, ids_col, xs, ys), false, "ID is not unique! ID = %i", obj.id);
+
+    ids_col[i] = obj.id;
+    xs[i] = (int16_t)obj.x;
+    ys[i] = (int16_t)obj.y;
+    h.min_x = xs[i] < h.min_x ? xs[i] : h.min_x;
+    h.min_y = ys[i] < h.min_y ? ys[i] : h.min_y;
+    h.max_x = xs[i] > h.max_x ? xs[i] : h.max_x;
+    h.max_y = ys[i] > h.max_y ? ys[i] : h.max_y;
+  }
+
+  FILE *out = fopen(out_filename, "wb");
+  CHECK(out != NULL, convert_cleanup(&reader, &ids, ids_col, xs, ys), false, "Failed to open file '%s' for writing.", out_filename);
+  bool written = fwrite(&h, sizeof(h), 1, out) == 1
+              && fwrite(ids_col, sizeof(*ids_col), n, out) == (size_t)n
+              && fwrite(xs, sizeof(*xs), n, out) == (size_t)n
+              && fwrite(ys, sizeof(*ys), n, out) == (size_t)n;
+  written = (fclose(out) == 0) && written;
+  CHECK(written, convert_cleanup(&reader, &ids, ids_col, xs, ys), false, "Failed to write file '%s'.", out_filename);
+
+  convert_cleanup(&reader, &ids, ids_col, xs, ys);
+  return true;
+}
+
+/*
+ Tisk pole shluku. Parametr 'carr' je ukazatel na prvni polozku (shluk).
+ Tiskne se prvnich 'narr' shluku.
+*/
+void print_clusters(struct cluster_t *carr, int narr)
+{
+  printf("Clusters:\n");
+  for (int i = 0; i < narr; i++)
+  {
+      printf("cluster %d: ", i);
+      print_cluster(&carr[i]);
+  }
+}
+
+// Parsuje kladne cele cislo z retezce 's'. Vraci false, pokud retezec neni cele cislo >= 1.
+bool parse_positive_int(const char *s, int *out)
+{
+  char *end = NULL;
+  long val = strtol(s, &end, 10);
+  if (*s == '\0' || *end != '\0' || val < 1 || val > INT_MAX)
+    return false;
+  *out = (int)val;
+  return true;
+}
+
+bool parse_arguments(int argc, char **argv, PrgArg *args)
+{
+  // Brzky exit.
+  if (argc == 1)
+    return false;
+
+  args->filename = argv[1];
+  args->n_clusters = 1;
+  args->k_means = false;
+  args->stream = false;
+  args->batch_size = STREAM_BATCH_SIZE;
+  args->kernel = NULL;
+  args->convert_to = NULL;
+  args->linkage_out = NULL;
+  args->linkage_in = NULL;
+  args->threshold = -1.0f;
+  args->chain = false;
+  args->link_kind = LINK_SINGLE;
+  args->snap = 0;
+  args->profile = false;
+  args->snapshot_out = NULL;
+  args->update_from = NULL;
+
+  // Parsni cluster count, pokud je zadan.
+  int i = 2;
+  if (argc >= 3 && argv[2][0] != '-') {
+    if (!parse_positive_int(argv[2], &args->n_clusters))
+      return false;
+    i++;
+  }
+
+  // Zkontroluj volitelne flagy.
+  for (; i < argc; i++) {
+    if (strcmp("-k", argv[i]) == 0)
+      args->k_means = true;
+    else if (strcmp("--stream", argv[i]) == 0)
+      args->stream = true;
+    else if (strncmp("--batch=", argv[i], 8) == 0) {
+      if (!parse_positive_int(argv[i] + 8, &args->batch_size))
+        return false;
+    }
+    else if (strncmp("--kernel=", argv[i], 9) == 0)
+      args->kernel = argv[i] + 9;
+    else if (strncmp("--convert=", argv[i], 10) == 0 && argv[i][10] != '\0')
+      args->convert_to = argv[i] + 10;
+    else if (strncmp("--save-linkage=", argv[i], 15) == 0 && argv[i][15] != '\0')
+      args->linkage_out = argv[i] + 15;
+    else if (strncmp("--cut=", argv[i], 6) == 0 && argv[i][6] != '\0')
+      args->linkage_in = argv[i] + 6;
+    else if (strncmp("--threshold=", argv[i], 12) == 0) {
+      char *end = NULL;
+      args->threshold = strtof(argv[i] + 12, &end);
+      if (end == argv[i] + 12 || *end != '\0' || !(args->threshold >= 0.0f))
+        return false;
+    }
+    else if (strcmp("--profile", argv[i]) == 0)
+      args->profile = true;
+    else if (strncmp("--save-snapshot=", argv[i], 16) == 0 && argv[i][16] != '\0')
+      args->snapshot_out = argv[i] + 16;
+    else if (strncmp("--update=", argv[i], 9) == 0 && argv[i][9] != '\0')
+      args->update_from = argv[i] + 9;
+    else if (strcmp("--dedup", argv[i]) == 0)
+      args->snap = args->snap > 0 ? args->snap : 1;
+    else if (strncmp("--snap=", argv[i], 7) == 0) {
+      if (!parse_positive_int(argv[i] + 7, &args->snap))
+        return false;
+    }
+    else if (strcmp("--engine=chain", argv[i]) == 0)
+      args->chain = true;
+    else if (strcmp("--engine=nn", argv[i]) == 0)
+      args->chain = false;
+    else if (strncmp("--method=", argv[i], 9) == 0) {
+      int kind = 0;
+      while (kind < N_LINK_KINDS && strcmp(LINK_NAMES[kind], argv[i] + 9) != 0)
+        kind++;
+      if (kind == N_LINK_KINDS)
+        return false;
+      args->link_kind = (LinkKind)kind;
+    }
+    else
+      return false;
+  }
+
+  // Snimek je kostra single linkage nad vsemi objekty, bez slouceni bodu.
+  if (args->snapshot_out != NULL || args->update_from != NULL)
+    return args->link_kind == LINK_SINGLE && args->snap == 0;
+
+  // nn_method() umi pouze single linkage.
+  return args->chain || args->link_kind == LINK_SINGLE;
+}
+
+/*****************************************************************
+ * Slucovani stejnych bodu pred shlukovanim.
+ *
+ * Souradnice jsou cela cisla v mrizce (MAX_XY_VALUE + 1)^2, takze velke
+ * vstupy obsahuji mnoho stejnych bodu. Objekty se stejnymi souradnicemi
+ * (pripadne zaokrouhlenymi na mrizku s krokem 'snap') se nahradi jednim
+ * reprezentantem s vahou rovnou poctu objektu. Shlukuji se pak jen
+ * reprezentanti a pri vypisu se nahradi puvodnimi objekty.
+ *
+ * Reprezentant ma ID sveho prvniho objektu a misto je ocislovano podle
+ * prvniho vyskytu, takze poradi vypsanych shluku odpovida shlukovani bez
+ * slucovani bodu.
+ */
+typedef struct dedup_t {
+  int           n_sites;
+  struct obj_t  *reps;     // Reprezentanti mist.
+  int           *weight;   // Pocet objektu v miste.
+  int           *start;    // Objekty mista 's' jsou members[start[s]] az members[start[s + 1] - 1].
+  struct obj_t  *members;  // Puvodni objekty serazene podle mista.
+  IdMap         site_of;   // ID reprezentanta -> index mista.
+} Dedup;
+
+void dedup_free(Dedup *dd)
+{
+  free(dd->reps);
+  free(dd->weight);
+  free(dd->start);
+  free(dd->members);
+  id_map_free(&dd->site_of);
+  memset(dd, 0, sizeof(*dd));
+}
+
+/*
+ Najde mista objektu v pocatecnich (jednoprvkovych) shlucich 'carr'. Body se
+ zaokrouhli na nejblizsi nasobek 'snap', pro snap = 1 se slucuji jen
+ totozne body.
+*/
+bool dedup_build(Dedup *dd, struct cluster_t *carr, int narr, int snap)
+{
+  memset(dd, 0, sizeof(*dd));
+  int side = (MAX_XY_VALUE + snap / 2) / snap + 1;
+  int *site_of_cell = (int *)malloc((size_t)side * side * sizeof(*site_of_cell));
+  int *site = (int *)malloc(narr * sizeof(*site));
+  dd->reps = (struct obj_t *)malloc(narr * sizeof(*dd->reps));
+  dd->weight = (int *)calloc(narr, sizeof(*dd->weight));
+  dd->members = (struct obj_t *)malloc(narr * sizeof(*dd->members));
+  bool ok = site_of_cell && site && dd->reps && dd->weight && dd->members;
+  if (ok)
+    memset(site_of_cell, -1, (size_t)side * side * sizeof(*site_of_cell));
+
+  for (int i = 0; ok && i < narr; i++) {
+    const struct obj_t *o = carr[i].obj;
+    int cx = ((int)o->x + snap / 2) / snap, cy = ((int)o->y + snap / 2) / snap;
+    int *cell = site_of_cell + (size_t)cy * side + cx;
+    if (*cell < 0) {
+      *cell = dd->n_sites++;
+      dd->reps[*cell].id = o->id;
+      // Zaokrouhleni nahoru muze skoncit za okrajem plochy.
+      dd->reps[*cell].x = cx * snap < MAX_XY_VALUE ? cx * snap : MAX_XY_VALUE;
+      dd->reps[*cell].y = cy * snap < MAX_XY_VALUE ? cy * snap : MAX_XY_VALUE;
+    }
+    site[i] = *cell;
+    dd->weight[*cell]++;
+  }
+  free(site_of_cell);
+
+  ok = ok && (dd->start = (int *)malloc((dd->n_sites + 1) * sizeof(*dd->start))) != NULL
+          && id_map_init(&dd->site_of, dd->n_sites);
+  if (!ok) {
+    free(site);
+    dedup_free(dd);
+    perr("Failed to allocate memory for duplicate points.");
+    return false;
+  }
+
+  // Rozdeleni objektu podle mist (counting sort, v miste zustava poradi nacteni).
+  dd->start[0] = 0;
+  for (int s = 0; s < dd->n_sites; s++) {
+    dd->start[s + 1] = dd->start[s] + dd->weight[s];
+    id_map_insert(&dd->site_of, dd->reps[s].id, s);
+  }
+  for (int i = narr - 1; i >= 0; i--)
+    dd->members[--dd->start[site[i] + 1]] = carr[i].obj[0];
+  // Predchozi smycka posunula zacatky o jedno misto zpet.
+  for (int s = 0; s < dd->n_sites; s++)
+    dd->start[s + 1] = dd->start[s] + dd->weight[s];
+
+  free(site);
+  return true;
+}
+
+/*
+ Nahradi pocatecni shluky 'carr' reprezentanty mist. Shluky za poslednim
+ mistem se vyprazdni. Vraci novy pocet shluku.
+*/
+int dedup_apply(const Dedup *dd, struct cluster_t *carr, int narr)
+{
+  // Misto 's' ma prvni vyskyt nejpozdeji na indexu 's', jeho slot uz je
+  // tedy precten a muze se prepsat.
+  for (int s = 0; s < dd->n_sites; s++) {
+    carr[s].obj[0] = dd->reps[s];
+    if (arena_owns(carr[s].obj))
+      arena_sync(carr + s, 0);
+  }
+  for (int i = dd->n_sites; i < narr; i++)
+    clear_cluster(carr + i);
+  return dd->n_sites;
+}
+
+// Pocet puvodnich objektu ve shluku reprezentantu 'c' (pro 'dd' == NULL jeho velikost).
+int expanded_size(const Dedup *dd, const struct cluster_t *c)
+{
+  if (dd == NULL)
+    return c->size;
+  int total = 0;
+  for (int j = 0; j < c->size; j++)
+    total += dd->weight[id_map_get(&dd->site_of, c->obj[j].id)];
+  return total;
+}
+
+/*
+ Vytiskne shluky reprezentantu 'carr' s puvodnimi objekty. Pro 'dd' == NULL
+ vytiskne shluky primo.
+*/
+void print_expanded(const Dedup *dd, struct cluster_t *carr, int narr)
+{
+  if (dd == NULL) {
+    print_clusters(carr, narr);
+    return;
+  }
+
+  struct cluster_t *out = (struct cluster_t *)calloc(narr, sizeof(*out));
+  assert(out != NULL); // Dosla pamet? :(
+  for (int i = 0; i < narr; i++) {
+    init_cluster(out + i, expanded_size(dd, carr + i));
+    for (int j = 0; j < carr[i].size; j++) {
+      int s = id_map_get(&dd->site_of, carr[i].obj[j].id);
+      for (int m = dd->start[s]; m < dd->start[s + 1]; m++)
+        append_cluster(out + i, dd->members[m]);
+    }
+    sort_cluster(out + i);
+  }
+
+  print_clusters(out, narr);
+  delete_clusters(&out, narr);
+}
+
+/*****************************************************************
+ * Historie slucovani (dendrogram).
+ *
+ * Kazde slouceni je ulozeno jako dvojice ID objektu, ktere lezi v prvnim
+ * a druhem slucovanem shluku, ctvercova vzdalenost shluku a velikost
+ * vysledneho shluku. Slouceni jsou serazena podle vzdalenosti, takze rez pro
+ * libovolny pocet shluku nebo vzdalenost je jen prefix historie.
+ */
+#define LINKAGE_MAGIC "IZPL"
+#define LINKAGE_VERSION 2
+
+typedef struct merge_t {
+  int32_t id1;
+  int32_t id2;
+  float   dist;  // Ctvercova vzdalenost slucovanych shluku.
+  int32_t size;  // Velikost shluku po slouceni.
+} Merge;
+
+typedef struct linkage_t {
+  int   n_obj;
+  int   n_merges;
+  Merge *merges;
+  LinkKind kind; // Vazba, kterou byla historie spocitana.
+  int   snap;    // Krok mrizky, na kterou byly body slouceny (0 = neslucovane).
+} Linkage;
+
+typedef struct linkage_header_t {
+  char    magic[4];
+  uint32_t version;
+  int32_t n_obj;
+  int32_t n_merges;
+  int32_t kind;
+  int32_t snap;
+} LinkageHeader;
+
+void linkage_free(Linkage *l)
+{
+  free(l->merges);
+  l->merges = NULL;
+  l->n_merges = 0;
+}
+
+// Pripravi prazdnou historii pro 'n_obj' objektu.
+bool linkage_init(Linkage *l, int n_obj)
+{
+  l->n_obj = n_obj;
+  l->n_merges = 0;
+  l->kind = LINK_SINGLE;
+  l->snap = 0;
+  l->merges = (Merge *)malloc((n_obj > 1 ? n_obj - 1 : 1) * sizeof(*l->merges));
+  CHECK(l->merges != NULL, (void)0, false, "Failed to allocate memory for merge history.");
+  return true;
+}
+
+void linkage_add(Linkage *l, int id1, int id2, float dist, int size)
+{
+  assert(l->n_merges < l->n_obj - 1);
+  Merge m = { id1, id2, dist, size };
+  l->merges[l->n_merges++] = m;
+}
+
+bool linkage_save(const Linkage *l, const char *filename)
+{
+  FILE *fd = fopen(filename, "wb");
+  CHECK(fd != NULL, (void)0, false, "Failed to open file '%s' for writing.", filename);
+
+  LinkageHeader h = { .version = LINKAGE_VERSION, .n_obj = l->n_obj, .n_merges = l->n_merges,
+                      .kind = l->kind, .snap = l->snap };
+  memcpy(h.magic, LINKAGE_MAGIC, sizeof(h.magic));
+  bool written = fwrite(&h, sizeof(h), 1, fd) == 1
+              && fwrite(l->merges, sizeof(*l->merges), l->n_merges, fd) == (size_t)l->n_merges;
+  written = (fclose(fd) == 0) && written;
+  CHECK(written, (void)0, false, "Failed to write file '%s'.", filename);
+  return true;
+}
+
+bool linkage_load(Linkage *l, const char *filename)
+{
+  FILE *fd = fopen(filename, "rb");
+  CHECK(fd != NULL, (void)0, false, "Failed to open file '%s' for reading.", filename);
+
+  LinkageHeader h;
+  bool valid = fread(&h, sizeof(h), 1, fd) == 1 && memcmp(h.magic, LINKAGE_MAGIC, sizeof(h.magic)) == 0
+            && h.version == LINKAGE_VERSION && h.n_obj > 0 && h.n_merges >= 0 && h.n_merges < h.n_obj
+            && h.kind >= 0 && h.kind < N_LINK_KINDS && h.snap >= 0;
+  CHECK(valid, fclose(fd), false, "Linkage file '%s' is corrupted.", filename);
+  CHECK(linkage_init(l, h.n_obj), fclose(fd), false, "Failed to load linkage file '%s'.", filename);
+
+  l->n_merges = h.n_merges;
+  l->kind = (LinkKind)h.kind;
+  l->snap = h.snap;
+  valid = fread(l->merges, sizeof(*l->merges), l->n_merges, fd) == (size_t)l->n_merges;
+  fclose(fd);
+  CHECK(valid, linkage_free(l), false, "Linkage file '%s' is corrupted.", filename);
+  return true;
+}
+
+// Koren stromu objektu 'i' v disjunktnich mnozinach 'parent' (s pulenim cesty).
+int uf_find(int *parent, int i)
+{
+  while (parent[i] != i) {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+
+// Spoji mnoziny objektu 'a' a 'b'. Koren je vzdy mensi index.
+void uf_union(int *parent, int a, int b)
+{
+  a = uf_find(parent, a);
+  b = uf_find(parent, b);
+  if (a < b)
+    parent[b] = a;
+  else if (b < a)
+    parent[a] = b;
+}
+
+void cut_cleanup(int *parent, int *group, IdMap *ids)
+{
+  free(parent);
+  free(group);
+  id_map_free(ids);
+}
+
+/*
+ Rozreze historii 'l' nad objekty 'objs' (v poradi nacteni ze souboru).
+ Pouzije prvnich n - 'n_wanted' slouceni, ale jen ta se vzdalenosti nejvyse
+ 'max_dist' (ctvercova, INFINITY = bez omezeni). Vysledne shluky ulozi do
+ nove alokovaneho pole '*out' ve stejnem poradi a formatu, jaky by vytvoril
+ nn_method(). Vraci pocet shluku nebo 0 pri chybe.
+*/
+int linkage_cut(const Linkage *l, const struct obj_t *objs, int n, int n_wanted, float max_dist, struct cluster_t **out)
+{
+  *out = NULL;
+  CHECK(l->n_obj == n, (void)0, 0, "Linkage was computed for %i objects, but %i were loaded.", l->n_obj, n);
+
+  IdMap ids = { 0 };
+  int *parent = (int *)malloc(n * sizeof(*parent));
+  int *group = (int *)malloc(n * sizeof(*group));
+  CHECK(parent && group && id_map_init(&ids, n), cut_cleanup(parent, group, &ids), 0, "Failed to allocate memory for linkage cut.");
+  for (int i = 0; i < n; i++) {
+    parent[i] = i;
+    id_map_insert(&ids, objs[i].id, i);
+  }
+
+  // Aplikuj prefix historie.
+  int n_apply = n - n_wanted;
+  for (int m = 0; m < n_apply && m < l->n_merges && l->merges[m].dist <= max_dist; m++) {
+    int a = id_map_get(&ids, l->merges[m].id1);
+    int b = id_map_get(&ids, l->merges[m].id2);
+    CHECK(a >= 0 && b >= 0, cut_cleanup(parent, group, &ids), 0, "Linkage does not match loaded objects.");
+    uf_union(parent, a, b);
+  }
+
+  // Shluky jsou ocislovany podle nejmensiho indexu objektu, ktery obsahuji.
+  // Stejne poradi vznika v nn_method(), protoze shluk zustava na mensim indexu.
+  int n_groups = 0;
+  for (int i = 0; i < n; i++) {
+    int root = uf_find(parent, i);
+    group[i] = root == i ? n_groups++ : group[root];
+  }
+
+  *out = (struct cluster_t *)calloc(n_groups, sizeof(**out));
+  CHECK(*out != NULL, cut_cleanup(parent, group, &ids), 0, "Failed to allocate memory for cluster array.");
+  // Pole 'parent' uz neni potreba, poslouzi pro velikosti skupin.
+  memset(parent, 0, n * sizeof(*parent));
+  for (int i = 0; i < n; i++)
+    parent[group[i]]++;
+  for (int g = 0; g < n_groups; g++)
+    init_cluster(*out + g, parent[g]);
+  for (int i = 0; i < n; i++)
+    append_cluster(*out + group[i], objs[i]);
+  for (int g = 0; g < n_groups; g++)
+    sort_cluster(*out + g);
+
+  cut_cleanup(parent, group, &ids);
+  return n_groups;
+}
+
+/*
+ Metoda nejblizsiho souseda pro shlukovani clusteru. Pokud 'history' neni
+ NULL, zaznamena do ni kazde slouceni. Pokud 'dd' neni NULL, jsou clustery
+ reprezentanti mist z dedup_build() a velikost v historii je pocet puvodnich
+ objektu.
+*/
+void nn_method(struct cluster_t *clusters, int narr, int n_wanted_clusters, Linkage *history, const Dedup *dd)
+{
+  // Ze zacatku jsou vsechny clustery ve svem clusteru.
+  int n_clusters = narr, c1, c2;
+  while (n_clusters > n_wanted_clusters) {
+    // Najdi dva nejbizsi clustery.
+    prof_start(t);
+    find_neighbours(clusters, n_clusters, &c1, &c2);
+    if (history != NULL)
+      linkage_add(history, clusters[c1].obj[0].id, clusters[c2].obj[0].id,
+                  cluster_distance(clusters + c1, clusters + c2),
+                  expanded_size(dd, clusters + c1) + expanded_size(dd, clusters + c2));
+    prof_phase(neighbours, t);
+    // Sluc druhy cluster do prvniho.
+    merge_clusters(clusters + c1, clusters + c2);
+    // Odstran druhy cluster, protoze ho uz nepotrebujeme.
+    n_clusters = remove_cluster(clusters, n_clusters, c2);
+    prof_count(merges, 1);
+    prof_phase(merge, t);
+  }
+}
+
+/*****************************************************************
+ * Shlukovani pomoci retezce nejblizsich sousedu (NN-chain).
+ *
+ * Retezec zacina libovolnym shlukem a pokracuje vzdy nejblizsim sousedem
+ * posledniho shluku. Jakmile jsou posledni dva shluky vzajemne nejblizsi,
+ * slouci se. Pro redukovatelne vazby (complete, average, Ward) tak
+ * vznikne stejna hierarchie jako pri hledani globalne nejblizsi dvojice,
+ * ale v case O(n^2). Slouceni nevznikaji v poradi podle vzdalenosti, proto
+ * se historie na konci seradi.
+ *
+ * Complete a average pouzivaji kondenzovanou matici vzdalenosti
+ * aktualizovanou Lance-Williamsovym vzorcem (pamet O(n^2)). Ward pocita
+ * vzdalenost z tezist a velikosti shluku, takze mu staci pamet O(n). Single
+ * linkage retezec nepotrebuje: jeho historie je minimalni kostra, kterou
+ * Primuv algoritmus najde take v case O(n^2) a s pameti O(n)
+ * (viz single_linkage_mst()).
+ */
+typedef struct chain_state_t {
+  int       n;
+  LinkKind  kind;
+  int       *size;    // Velikost shluku na danem indexu.
+  float     *height;  // Vzdalenost posledniho slouceni, ktere shluk vytvorilo.
+  float     *dist;    // Kondenzovana matice vzdalenosti (NULL pro Ward).
+  float     *cx;      // Teziste shluku (jen Ward).
+  float     *cy;
+  int       *active;  // Indexy aktivnich shluku.
+  int       *pos;     // Pozice indexu v 'active' (-1 = shluk byl sloucen).
+  int       n_active;
+  int       *chain;
+} ChainState;
+
+// Index dvojice (i, j), i < j, v kondenzovane matici n x n.
+static inline size_t condensed_idx(int n, int i, int j)
+{
+  return (size_t)i * (2 * (size_t)n - i - 1) / 2 + (size_t)(j - i - 1);
+}
+
+void chain_free(ChainState *st)
+{
+  free(st->size);
+  free(st->height);
+  free(st->dist);
+  free(st->cx);
+  free(st->cy);
+  free(st->active);
+  free(st->pos);
+  free(st->chain);
+  memset(st, 0, sizeof(*st));
+}
+
+bool chain_init(ChainState *st, const struct obj_t *objs, const int *weights, int n, LinkKind kind)
+{
+  memset(st, 0, sizeof(*st));
+  st->n = st->n_active = n;
+  st->kind = kind;
+  st->size = (int *)malloc(n * sizeof(*st->size));
+  st->height = (float *)malloc(n * sizeof(*st->height));
+  st->cx = (float *)malloc(n * sizeof(*st->cx));
+  st->cy = (float *)malloc(n * sizeof(*st->cy));
+  st->active = (int *)malloc(n * sizeof(*st->active));
+  st->pos = (int *)malloc(n * sizeof(*st->pos));
+  st->chain = (int *)malloc(n * sizeof(*st->chain));
+  CHECK(st->size && st->height && st->cx && st->cy && st->active && st->pos && st->chain, chain_free(st), false, "Failed to allocate memory for NN-chain.");
+
+  for (int i = 0; i < n; i++) {
+    st->size[i] = weights != NULL ? weights[i] : 1;
+    st->height[i] = 0.0f;
+    st->cx[i] = objs[i].x;
+    st->cy[i] = objs[i].y;
+    st->active[i] = st->pos[i] = i;
+  }
+  if (kind == LINK_WARD)
+    return true;
+  assert(kind != LINK_SINGLE);
+
+  // Matice se plni po radcich, radek 'i' jsou vzdalenosti k objektum i+1..n-1.
+  size_t n_pairs = (size_t)n * (n - 1) / 2;
+  st->dist = (float *)malloc((n_pairs > 0 ? n_pairs : 1) * sizeof(*st->dist));
+  CHECK(st->dist != NULL, chain_free(st), false, "Failed to allocate memory for distance matrix (%i objects).", n);
+  for (int i = 0; i < n - 1; i++) {
+    float *row = st->dist + condensed_idx(n, i, i + 1);
+    kern->batch(st->cx[i], st->cy[i], st->cx + i + 1, st->cy + i + 1, n - i - 1, row);
+    // Prumer se pocita z opravdovych vzdalenosti, ne z jejich ctvercu.
+    if (kind == LINK_AVERAGE)
+      for (int j = 0; j < n - i - 1; j++)
+        row[j] = sqrtf(row[j]);
+  }
+  prof_count(dist_evals, n_pairs);
+  return true;
+}
+
+// Vzdalenost aktivnich shluku 'a' a 'b' podle zvolene vazby.
+float chain_dist(const ChainState *st, int a, int b)
+{
+  if (st->kind == LINK_WARD) {
+    // Prirustek souctu ctvercu odchylek po slouceni.
+    prof_count(dist_evals, 1);
+    float dx = st->cx[a] - st->cx[b];
+    float dy = st->cy[a] - st->cy[b];
+    float na = st->size[a], nb = st->size[b];
+    return na * nb / (na + nb) * (dx * dx + dy * dy);
+  }
+  return a < b ? st->dist[condensed_idx(st->n, a, b)] : st->dist[condensed_idx(st->n, b, a)];
+}
+
+/*
+ Slouci shluk 'drop' do shluku 'keep' a aktualizuje vzdalenosti ostatnich
+ aktivnich shluku ke 'keep'.
+*/
+void chain_merge(ChainState *st, int keep, int drop)
+{
+  float nk = st->size[keep], nd = st->size[drop];
+
+  if (st->kind == LINK_WARD) {
+    st->cx[keep] = (nk * st->cx[keep] + nd * st->cx[drop]) / (nk + nd);
+    st->cy[keep] = (nk * st->cy[keep] + nd * st->cy[drop]) / (nk + nd);
+  } else {
+    for (int t = 0; t < st->n_active; t++) {
+      int k = st->active[t];
+      if (k == keep || k == drop)
+        continue;
+      float d_keep = chain_dist(st, k, keep), d_drop = chain_dist(st, k, drop), d;
+      if (st->kind == LINK_COMPLETE)
+        d = fmaxf(d_keep, d_drop);
+      else
+        d = (nk * d_keep + nd * d_drop) / (nk + nd);
+      st->dist[k < keep ? condensed_idx(st->n, k, keep) : condensed_idx(st->n, keep, k)] = d;
+    }
+  }
+
+  st->size[keep] += st->size[drop];
+  // Odeber 'drop' ze seznamu aktivnich shluku.
+  int p = st->pos[drop];
+  st->active[p] = st->active[--st->n_active];
+  st->pos[st->active[p]] = p;
+  st->pos[drop] = -1;
+}
+
+// Slouceni s poradim vzniku, aby razeni podle vzdalenosti bylo stabilni.
+typedef struct seq_merge_t {
+  Merge m;
+  int   seq;
+} SeqMerge;
+
+static int seq_merge_compar(const void *a, const void *b)
+{
+  const SeqMerge *m1 = (const SeqMerge *)a;
+  const SeqMerge *m2 = (const SeqMerge *)b;
+  if (m1->m.dist != m2->m.dist)
+    return m1->m.dist < m2->m.dist ? -1 : 1;
+  return m1->seq - m2->seq;
+}
+
+// Stabilne seradi historii podle vzdalenosti slouceni.
+bool linkage_sort(Linkage *l)
+{
+  SeqMerge *tmp = (SeqMerge *)malloc((l->n_merges > 0 ? l->n_merges : 1) * sizeof(*tmp));
+  CHECK(tmp != NULL, (void)0, false, "Failed to allocate memory for sorting merge history.");
+  for (int i = 0; i < l->n_merges; i++) {
+    tmp[i].m = l->merges[i];
+    tmp[i].seq = i;
+  }
+  qsort(tmp, l->n_merges, sizeof(*tmp), seq_merge_compar);
+  for (int i = 0; i < l->n_merges; i++)
+    l->merges[i] = tmp[i].m;
+  free(tmp);
+  return true;
+}
+
+/*
+ Spocita historii single linkage objektu 'objs' jako minimalni kostru
+ Primovym algoritmem. Pro kazdy objekt mimo strom se drzi jen ctvercova
+ vzdalenost ke stromu a nejblizsi objekt stromu, pamet je tedy O(n). Objekty
+ mimo strom lezi na zacatku poli 'rx', 'ry', aby je jadro zpracovalo naraz.
+ Velikosti shluku se dopocitaji az po serazeni hran.
+*/
+bool single_linkage_mst(const struct obj_t *objs, const int *weights, int n, Linkage *history)
+{
+  prof_start(t);
+  float *rx = (float *)malloc(n * sizeof(*rx));
+  float *ry = (float *)malloc(n * sizeof(*ry));
+  float *best = (float *)malloc(n * sizeof(*best));
+  float *row = (float *)malloc(n * sizeof(*row));
+  int *idx = (int *)malloc(n * sizeof(*idx));  // Index objektu na dane pozici.
+  int *from = (int *)malloc(n * sizeof(*from)); // Nejblizsi objekt stromu.
+  bool ok = rx && ry && best && row && idx && from;
+  if (ok) {
+    for (int i = 0; i < n; i++) {
+      rx[i] = objs[i].x;
+      ry[i] = objs[i].y;
+      best[i] = INFINITY;
+      idx[i] = i;
+      from[i] = -1;
+    }
+
+    // Strom zacina objektem 0, ktery se presune za objekty mimo strom.
+    int m = n - 1, cur = 0;
+    rx[0] = rx[m]; ry[0] = ry[m]; idx[0] = idx[m];
+    while (m > 0) {
+      kern->batch(objs[cur].x, objs[cur].y, rx, ry, m, row);
+      prof_count(dist_evals, m);
+      int next = 0;
+      for (int i = 0; i < m; i++) {
+        if (row[i] < best[i]) {
+          best[i] = row[i];
+          from[i] = cur;
+        }
+        if (best[i] < best[next])
+          next = i;
+      }
+
+      cur = idx[next];
+      linkage_add(history, objs[from[next]].id, objs[cur].id, best[next], 0);
+      prof_count(merges, 1);
+      m--;
+      rx[next] = rx[m]; ry[next] = ry[m]; idx[next] = idx[m];
+      best[next] = best[m]; from[next] = from[m];
+    }
+  }
+  free(rx);
+  free(ry);
+  free(best);
+  free(row);
+  free(idx);
+  CHECK(ok, free(from), false, "Failed to allocate memory for spanning tree.");
+  prof_phase(neighbours, t);
+
+  // Hrany v poradi podle vzdalenosti odpovidaji slucovani shluku, velikosti
+  // vznikajicich shluku se dopocitaji pres disjunktni mnoziny. Pole 'from'
+  // poslouzi jako 'parent', 'size' drzi velikosti korenu.
+  int *size = (int *)malloc(n * sizeof(*size));
+  CHECK(size != NULL && linkage_sort(history), (free(from), free(size)), false, "Failed to allocate memory for spanning tree.");
+  IdMap ids = { 0 };
+  CHECK(id_map_init(&ids, n), (free(from), free(size)), false, "Failed to allocate memory for object IDs.");
+  for (int i = 0; i < n; i++) {
+    from[i] = i;
+    size[i] = weights != NULL ? weights[i] : 1;
+    id_map_insert(&ids, objs[i].id, i);
+  }
+  for (int e = 0; e < history->n_merges; e++) {
+    Merge *mg = history->merges + e;
+    int a = uf_find(from, id_map_get(&ids, mg->id1));
+    int b = uf_find(from, id_map_get(&ids, mg->id2));
+    uf_union(from, a, b);
+    mg->size = size[a < b ? a : b] = size[a] + size[b];
+  }
+
+  id_map_free(&ids);
+  free(from);
+  free(size);
+  prof_phase(merge, t);
+  return true;
+}
+
+/*
+ Spocita celou hierarchii objektu 'objs' metodou NN-chain a ulozi ji do
+ 'history' serazenou podle vzdalenosti slouceni. Objekt 'i' zastupuje
+ weights[i] stejnych bodu (NULL = kazdy objekt jeden bod). Single linkage se
+ pocita jako minimalni kostra funkci single_linkage_mst().
+*/
+bool chain_method(const struct obj_t *objs, const int *weights, int n, LinkKind kind, Linkage *history)
+{
+  if (kind == LINK_SINGLE)
+    return single_linkage_mst(objs, weights, n, history);
+
+  prof_start(t);
+  ChainState st;
+  if (!chain_init(&st, objs, weights, n, kind))
+    return false;
+
+  int len = 0;
+  while (st.n_active > 1) {
+    if (len == 0)
+      st.chain[len++] = st.active[0];
+
+    int a = st.chain[len - 1];
+    int prev = len >= 2 ? st.chain[len - 2] : -1;
+
+    // Nejblizsi soused 'a'. Pri shode ma prednost predchudce v retezci,
+    // jinak by se retezec mohl zacyklit.
+    int b = prev;
+    float best = prev >= 0 ? chain_dist(&st, a, prev) : INFINITY;
+    for (int t = 0; t < st.n_active; t++) {
+      int k = st.active[t];
+      if (k == a)
+        continue;
+      float d = chain_dist(&st, a, k);
+      if (d < best) {
+        best = d;
+        b = k;
+      }
+    }
+
+    prof_phase(neighbours, t);
+    if (b != prev) {
+      st.chain[len++] = b;
+      continue;
+    }
+
+    // 'a' a 'b' jsou vzajemne nejblizsi, sluc je. Vyska slouceni nesmi byt
+    // mensi nez vysky slucovanych shluku, jinak by zaokrouhlovani mohlo
+    // rozbit poradi po serazeni.
+    len -= 2;
+    int keep = a < b ? a : b, drop = a < b ? b : a;
+    float height = st.kind == LINK_AVERAGE ? best * best : best;
+    height = fmaxf(height, fmaxf(st.height[a], st.height[b]));
+    linkage_add(history, objs[a].id, objs[b].id, height, st.size[a] + st.size[b]);
+    chain_merge(&st, keep, drop);
+    st.height[keep] = height;
+    prof_count(merges, 1);
+    prof_phase(merge, t);
+  }
+
+  chain_free(&st);
+  return linkage_sort(history);
+}
+
+/*****************************************************************
+ * Snimek shlukovani (--save-snapshot, --update).
+ *
+ * Snimek obsahuje objekty v poradi nacteni a celou historii single linkage
+ * (n - 1 slouceni serazenych podle vzdalenosti). Historie single linkage je
+ * minimalni kostra objektu, takze z ni lze rez pro libovolny pocet shluku
+ * dopocitat a pri pridani objektu ji jen doplnit (viz update_method()).
+ */
+#define SNAPSHOT_MAGIC "IZPS"
+#define SNAPSHOT_VERSION 1
+
+typedef struct snapshot_header_t {
+  char    magic[4];
+  uint32_t version;
+  int32_t n_obj;
+  int32_t n_merges;
+} SnapshotHeader;
+
+bool snapshot_save(const struct obj_t *objs, const Linkage *l, const char *filename)
+{
+  FILE *fd = fopen(filename, "wb");
+  CHECK(fd != NULL, (void)0, false, "Failed to open file '%s' for writing.", filename);
+
+  SnapshotHeader h = { .version = SNAPSHOT_VERSION, .n_obj = l->n_obj, .n_merges = l->n_merges };
+  memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+  bool written = fwrite(&h, sizeof(h), 1, fd) == 1
+              && fwrite(objs, sizeof(*objs), l->n_obj, fd) == (size_t)l->n_obj
+              && fwrite(l->merges, sizeof(*l->merges), l->n_merges, fd) == (size_t)l->n_merges;
+  written = (fclose(fd) == 0) && written;
+  CHECK(written, (void)0, false, "Failed to write file '%s'.", filename);
+  return true;
+}
+
+void snapshot_cleanup(FILE *fd, struct obj_t **objs, Linkage *l)
+{
+  if (fd != NULL)
+    fclose(fd);
+  free(*objs);
+  *objs = NULL;
+  linkage_free(l);
+}
+
+/*
+ Nacte snimek ze souboru 'filename'. Objekty ulozi do nove alokovaneho pole
+ '*objs', ve kterem nechava misto pro 'extra' dalsich objektu, a historii do
+ 'l'. Vraci pocet objektu ve snimku nebo 0 pri chybe.
+*/
+int snapshot_load(const char *filename, int extra, struct obj_t **objs, Linkage *l)
+{
+  *objs = NULL;
+  FILE *fd = fopen(filename, "rb");
+  CHECK(fd != NULL, (void)0, 0, "Failed to open file '%s' for reading.", filename);
+
+  // Snimek musi obsahovat celou historii, jinak by nebyl kostrou.
+  SnapshotHeader h;
+  bool valid = fread(&h, sizeof(h), 1, fd) == 1 && memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) == 0
+            && h.version == SNAPSHOT_VERSION && h.n_obj > 0 && h.n_merges == h.n_obj - 1
+            && h.n_obj <= INT_MAX - extra;
+  CHECK(valid, fclose(fd), 0, "Snapshot file '%s' is corrupted.", filename);
+
+  *objs = (struct obj_t *)malloc((size_t)(h.n_obj + extra) * sizeof(**objs));
+  CHECK(*objs != NULL && linkage_init(l, h.n_obj), snapshot_cleanup(fd, objs, l), 0, "Failed to allocate memory for snapshot '%s'.", filename);
+
+  l->n_merges = h.n_merges;
+  valid = fread(*objs, sizeof(**objs), h.n_obj, fd) == (size_t)h.n_obj
+       && fread(l->merges, sizeof(*l->merges), l->n_merges, fd) == (size_t)l->n_merges;
+  fclose(fd);
+  CHECK(valid, snapshot_cleanup(NULL, objs, l), 0, "Snapshot file '%s' is corrupted.", filename);
+  return h.n_obj;
+}
+
+void dendrogram_cleanup(Linkage *l, struct obj_t *objs, struct cluster_t **cut, int n_cut)
+{
+  linkage_free(l);
+  free(objs);
+  if (*cut != NULL)
+    delete_clusters(cut, n_cut);
+}
+
+/*
+ Shlukovani pres celou historii slucovani. Historie se bud nacte ze souboru
+ (--cut), nebo se spocita az do jednoho shluku metodou nn_method() ci
+ NN-chain (--engine=chain) a pripadne ulozi (--save-linkage, --save-snapshot). Vysledek se vypise jako rez pro pozadovany pocet shluku
+ nebo vzdalenost (--threshold). Pokud 'dd' neni NULL, jsou shluky
+ 'clusters' reprezentanti mist z dedup_build().
+*/
+bool dendrogram_method(const PrgArg *args, struct cluster_t *clusters, int narr, const Dedup *dd)
+{
+  Linkage history = { 0 };
+  struct cluster_t *cut = NULL;
+  int n_cut = 0;
+  prof_start(t);
+
+  // Objekty v poradi nacteni, nn_method() je pri slucovani preusporada.
+  struct obj_t *objs = (struct obj_t *)malloc(narr * sizeof(*objs));
+  CHECK(objs != NULL, (void)0, false, "Failed to allocate memory for objects.");
+  for (int i = 0; i < narr; i++)
+    objs[i] = clusters[i].obj[0];
+
+  if (args->linkage_in != NULL) {
+    if (!linkage_load(&history, args->linkage_in)) {
+      dendrogram_cleanup(&history, objs, &cut, n_cut);
+      return false;
+    }
+  } else {
+    if (!linkage_init(&history, narr)) {
+      dendrogram_cleanup(&history, objs, &cut, n_cut);
+      return false;
+    }
+    history.kind = args->chain ? args->link_kind : LINK_SINGLE;
+    history.snap = args->snap;
+    if (args->chain) {
+      if (!chain_method(objs, dd != NULL ? dd->weight : NULL, narr, args->link_kind, &history)) {
+        dendrogram_cleanup(&history, objs, &cut, n_cut);
+        return false;
+      }
+    }
+    else
+      nn_method(clusters, narr, 1, &history, dd);
+  }
+
+  if (args->linkage_out != NULL && !linkage_save(&history, args->linkage_out)) {
+    dendrogram_cleanup(&history, objs, &cut, n_cut);
+    return false;
+  }
+  if (args->snapshot_out != NULL) {
+    // Snimek je minimalni kostra, takze historie nactena prepinacem --cut
+    // musi byt uplna historie single linkage nad temi samymi neslucovanymi body.
+    CHECK(history.kind == LINK_SINGLE, dendrogram_cleanup(&history, objs, &cut, n_cut), false,
+          "Snapshot requires single linkage, but the linkage was computed with %s linkage.", LINK_NAMES[history.kind]);
+    CHECK(history.snap <= 1 && history.n_obj == narr && history.n_merges == narr - 1,
+          dendrogram_cleanup(&history, objs, &cut, n_cut), false,
+          "Snapshot requires a complete linkage of all %d objects without --snap.", narr);
+    if (!snapshot_save(objs, &history, args->snapshot_out)) {
+      dendrogram_cleanup(&history, objs, &cut, n_cut);
+      return false;
+    }
+  }
+
+  // Rez podle vzdalenosti ignoruje pozadovany pocet shluku.
+  if (args->threshold >= 0.0f)
+    n_cut = linkage_cut(&history, objs, narr, 1, args->threshold * args->threshold, &cut);
+  else
+    n_cut = linkage_cut(&history, objs, narr, args->n_clusters, INFINITY, &cut);
+  if (n_cut == 0) {
+    dendrogram_cleanup(&history, objs, &cut, n_cut);
+    return false;
+  }
+
+  prof_phase(cluster, t);
+  print_expanded(dd, cut, n_cut);
+  prof_phase(print, t);
+  dendrogram_cleanup(&history, objs, &cut, n_cut);
+  return true;
+}
+
+/*****************************************************************
+ * Prirustkove pridani objektu do snimku (--update).
+ *
+ * Minimalni kostra starych objektu V a novych objektu D je podmnozinou
+ * kostry V a hran, ktere vychazi z novych objektu. Z hran noveho objektu
+ * staci Yaouv graf: okoli objektu se rozdeli na 6 vyseci po 60 stupnich
+ * a hrana kostry vede vzdy k nejblizsimu objektu sve vysece. To plati jen
+ * pro objekty v nenulove vzdalenosti, objekt se stejnymi souradnicemi se
+ * proto do vyseci nezarazuje a novy objekt se s nim spoji hranou nulove
+ * delky (vzdy s tim s nejmensim indexem, takze stejne objekty tvori
+ * souvisly strom a dal se chovaji jako jeden bod). Nejblizsi objekty se
+ * hledaji v mrizce nad vsemi objekty po prstencich bunek od bunky noveho
+ * objektu, dokud neni kazda vysec vyresena. Nove hrany se seradi
+ * a Kruskaluv algoritmus je slouci se serazenou starou kostrou.
+ *
+ * Pocet spocitanych vzdalenosti je umerny poctu novych objektu (a hustote
+ * jejich okoli), ne velikosti snimku. Linearni v celkovem poctu objektu
+ * zustava cteni a zapis snimku, stavba mrizky a hashovaci tabulky ID,
+ * pruchod Kruskalova algoritmu a vypis shluku.
+ */
+#define YAO_CONES 6
+// Nejvetsi pocet bunek na strane mrizky.
+#define GRID_MAX_SIDE 1024
+#define PI 3.14159265358979323846f
+
+// Ctvercova mrizka nad plochou <0, MAX_XY_VALUE>^2.
+typedef struct grid_t {
+  int   side;   // Pocet bunek na strane.
+  float cell;   // Velikost strany bunky.
+  int   *start; // Zacatky bunek v 'items' (side * side + 1 polozek).
+  int   *items; // Indexy objektu serazene podle bunek.
+} Grid;
+
+void grid_free(Grid *g)
+{
+  free(g->start);
+  free(g->items);
+  g->start = NULL;
+  g->items = NULL;
+}
+
+static inline int grid_coord(const Grid *g, float v)
+{
+  int c = (int)(v / g->cell);
+  return c < 0 ? 0 : (c >= g->side ? g->side - 1 : c);
+}
+
+static inline int grid_cell(const Grid *g, const struct obj_t *o)
+{
+  return grid_coord(g, o->y) * g->side + grid_coord(g, o->x);
+}
+
+// Rozradi 'n' objektu 'objs' do bunek mrizky (v prumeru 2 objekty na bunku).
+bool grid_build(Grid *g, const struct obj_t *objs, int n)
+{
+  g->side = (int)sqrt(n / 2.0);
+  g->side = g->side < 1 ? 1 : (g->side > GRID_MAX_SIDE ? GRID_MAX_SIDE : g->side);
+  g->cell = (MAX_XY_VALUE + 1.0f) / g->side;
+  int n_cells = g->side * g->side;
+  g->start = (int *)calloc(n_cells + 1, sizeof(*g->start));
+  g->items = (int *)malloc(n * sizeof(*g->items));
+  CHECK(g->start != NULL && g->items != NULL, grid_free(g), false, "Failed to allocate memory for grid.");
+
+  // Trideni pocitanim. Po rozrazeni ukazuje start[c] na konec bunky 'c',
+  // takze se pole posune o jednu bunku.
+  for (int i = 0; i < n; i++)
+    g->start[grid_cell(g, objs + i) + 1]++;
+  for (int c = 0; c < n_cells; c++)
+    g->start[c + 1] += g->start[c];
+  for (int i = 0; i < n; i++)
+    g->items[g->start[grid_cell(g, objs + i)]++] = i;
+  memmove(g->start + 1, g->start, n_cells * sizeof(*g->start));
+  g->start[0] = 0;
+  return true;
+}
+
+// Index vysece, do ktere miri vektor [dx, dy].
+static inline int yao_cone(float dx, float dy)
+{
+  int c = (int)((atan2f(dy, dx) + PI) / (PI / YAO_CONES * 2));
+  return c >= YAO_CONES ? 0 : c;
+}
+
+/*
+ Nejvetsi Cebysevova vzdalenost od [px, py] k bodu vysece 'c', ktery lezi
+ na plose <0, MAX_XY_VALUE>^2. Dal uz ve vyseci zadny objekt byt nemuze.
+ Prunik vysece s plochou je konvexni, staci tedy projit jeho vrcholy:
+ konce hranicnich paprsku na okraji plochy a rohy plochy uvnitr vysece.
+*/
+float yao_reach(float px, float py, int c)
+{
+  const float m = MAX_XY_VALUE;
+  float a0 = -PI + c * (PI / YAO_CONES * 2);
+  float a1 = a0 + PI / YAO_CONES * 2;
+  float reach = 0.0f;
+
+  float rays[2] = { a0, a1 };
+  for (int k = 0; k < 2; k++) {
+    float ux = cosf(rays[k]), uy = sinf(rays[k]);
+    float t = INFINITY;
+    if (fabsf(ux) > 1e-6f)
+      t = fminf(t, ux > 0.0f ? (m - px) / ux : -px / ux);
+    if (fabsf(uy) > 1e-6f)
+      t = fminf(t, uy > 0.0f ? (m - py) / uy : -py / uy);
+    reach = fmaxf(reach, fmaxf(fabsf(t * ux), fabsf(t * uy)));
+  }
+
+  float corners[4][2] = { { 0.0f, 0.0f }, { m, 0.0f }, { 0.0f, m }, { m, m } };
+  for (int k = 0; k < 4; k++) {
+    float dx = corners[k][0] - px, dy = corners[k][1] - py;
+    float a = atan2f(dy, dx);
+    if ((dx != 0.0f || dy != 0.0f) && a >= a0 && a <= a1)
+      reach = fmaxf(reach, fmaxf(fabsf(dx), fabsf(dy)));
+  }
+
+  // Rezerva na zaokrouhleni uhlu.
+  return reach + 1.0f;
+}
+
+/*
+ Pro objekt 'objs[p]' najde v kazde vyseci nejblizsi jiny objekt z mrizky
+ 'g' a hrany k nim ulozi do 'edges' (nejvyse YAO_CONES + 1, posledni je
+ hrana nulove delky k objektu se stejnymi souradnicemi). Vraci pocet hran.
+*/
+int yao_edges(const Grid *g, const struct obj_t *objs, int p, Merge *edges)
+{
+  float px = objs[p].x, py = objs[p].y;
+  float best[YAO_CONES], reach[YAO_CONES];
+  int nearest[YAO_CONES];
+  int twin = -1;  // Objekt se stejnymi souradnicemi s nejmensim indexem.
+  for (int c = 0; c < YAO_CONES; c++) {
+    best[c] = INFINITY;
+    nearest[c] = -1;
+    reach[c] = yao_reach(px, py, c);
+  }
+
+  int gx = grid_coord(g, px), gy = grid_coord(g, py);
+  for (int r = 0; r < g->side; r++) {
+    for (int y = gy - r; y <= gy + r; y++) {
+      if (y < 0 || y >= g->side)
+        continue;
+      // Z prostrednich radku prstence jen krajni bunky.
+      int step = (r == 0 || y == gy - r || y == gy + r) ? 1 : 2 * r;
+      for (int x = gx - r; x <= gx + r; x += step) {
+        if (x < 0 || x >= g->side)
+          continue;
+        int cell = y * g->side + x;
+        for (int k = g->start[cell]; k < g->start[cell + 1]; k++) {
+          int q = g->items[k];
+          if (q == p)
+            continue;
+          float dx = objs[q].x - px, dy = objs[q].y - py;
+          float d = dx * dx + dy * dy;
+          if (d == 0.0f) {
+            twin = (twin < 0 || q < twin) ? q : twin;
+            continue;
+          }
+          int c = yao_cone(dx, dy);
+          if (d < best[c] || (d == best[c] && q < nearest[c])) {
+            best[c] = d;
+            nearest[c] = q;
+          }
+        }
+        prof_count(dist_evals, g->start[cell + 1] - g->start[cell]);
+      }
+    }
+
+    // Neprohledane objekty jsou od [px, py] dal nez r bunek.
+    float bound = r * g->cell;
+    bool done = true;
+    for (int c = 0; c < YAO_CONES && done; c++)
+      done = best[c] <= bound * bound || reach[c] <= bound;
+    if (done)
+      break;
+  }
+
+  int n_edges = 0;
+  for (int c = 0; c < YAO_CONES; c++)
+    if (nearest[c] >= 0) {
+      Merge e = { objs[p].id, objs[nearest[c]].id, best[c], 0 };
+      edges[n_edges++] = e;
+    }
+  if (twin >= 0) {
+    Merge e = { objs[p].id, objs[twin].id, 0.0f, 0 };
+    edges[n_edges++] = e;
+  }
+  return n_edges;
+}
+
+static int edge_compar(const void *a, const void *b)
+{
+  const Merge *e1 = (const Merge *)a;
+  const Merge *e2 = (const Merge *)b;
+  if (e1->dist != e2->dist)
+    return e1->dist < e2->dist ? -1 : 1;
+  if (e1->id1 != e2->id1)
+    return e1->id1 < e2->id1 ? -1 : 1;
+  return (e1->id2 > e2->id2) - (e1->id2 < e2->id2);
+}
+
+/*
+ Kruskaluv algoritmus nad serazenou kostrou 'old' a serazenymi hranami
+ 'edges'. Vysledna historie 'out' pokryva 'n' objektu, jejichz indexy podle
+ ID jsou v 'ids'. Pri shode vzdalenosti ma prednost stara hrana.
+*/
+bool kruskal_merge(const Linkage *old, const Merge *edges, int n_edges, const IdMap *ids, int n, Linkage *out)
+{
+  int *parent = (int *)malloc(n * sizeof(*parent));
+  int *size = (int *)malloc(n * sizeof(*size));
+  CHECK(parent && size && linkage_init(out, n), (free(parent), free(size)), false, "Failed to allocate memory for spanning tree.");
+  for (int i = 0; i < n; i++) {
+    parent[i] = i;
+    size[i] = 1;
+  }
+
+  int i = 0, j = 0;
+  while (out->n_merges < n - 1 && (i < old->n_merges || j < n_edges)) {
+    bool take_old = j >= n_edges || (i < old->n_merges && old->merges[i].dist <= edges[j].dist);
+    const Merge *e = take_old ? old->merges + i++ : edges + j++;
+    int a = id_map_get(ids, e->id1), b = id_map_get(ids, e->id2);
+    CHECK(a >= 0 && b >= 0, (free(parent), free(size), linkage_free(out)), false, "Snapshot does not match its objects.");
+
+    a = uf_find(parent, a);
+    b = uf_find(parent, b);
+    if (a == b)
+      continue;
+    uf_union(parent, a, b);
+    int joined = size[a] + size[b];
+    size[a < b ? a : b] = joined;
+    linkage_add(out, e->id1, e->id2, e->dist, joined);
+    prof_count(merges, 1);
+  }
+
+  free(parent);
+  free(size);
+  CHECK(out->n_merges == n - 1, linkage_free(out), false, "Updated spanning tree is not connected.");
+  return true;
+}
+
+typedef struct update_state_t {
+  ObjReader reader;
+  struct obj_t *objs;   // Objekty snimku a za nimi nove objekty.
+  Linkage old;          // Kostra ze snimku.
+  Linkage updated;      // Kostra vsech objektu.
+  IdMap ids;
+  Grid grid;
+  Merge *edges;         // Hrany Yaova grafu z novych objektu.
+  struct cluster_t *cut;
+  int n_cut;
+} UpdateState;
+
+void update_cleanup(UpdateState *u)
+{
+  reader_close(&u->reader);
+  free(u->objs);
+  linkage_free(&u->old);
+  linkage_free(&u->updated);
+  id_map_free(&u->ids);
+  grid_free(&u->grid);
+  free(u->edges);
+  if (u->cut != NULL)
+    delete_clusters(&u->cut, u->n_cut);
+}
+
+/*
+ Prida objekty ze souboru 'args->filename' (jen nove objekty) ke snimku
+ 'args->update_from', vypise rez doplnene kostry stejne jako
+ dendrogram_method() a pripadne ulozi novy snimek (--save-snapshot).
+*/
+bool update_method(const PrgArg *args)
+{
+  UpdateState u = { 0 };
+  prof_start(t);
+  if (!reader_open(&u.reader, args->filename))
+    return false;
+  int n_new = u.reader.n_total;
+  int n_old = snapshot_load(args->update_from, n_new, &u.objs, &u.old);
+  if (n_old == 0) {
+    update_cleanup(&u);
+    return false;
+  }
+  int n = n_old + n_new;
+  CHECK(n >= args->n_clusters, update_cleanup(&u), false, "Number of wanted clusters is too high.");
+
+  // ID novych objektu se kontroluji i proti objektum snimku.
+  CHECK(id_map_init(&u.ids, n), update_cleanup(&u), false, "Failed to allocate memory for object IDs.");
+  CHECK(reader_next_batch(&u.reader, u.objs + n_old, n_new) == n_new, update_cleanup(&u), false, "Failed to read objects from file '%s'.", args->filename);
+  reader_close(&u.reader);
+  for (int i = 0; i < n; i++)
+    CHECK(id_map_insert(&u.ids, u.objs[i].id, i), update_cleanup(&u), false, "ID is not unique! ID = %i", u.objs[i].id);
+  prof_phase(load, t);
+
+  // Hrany z novych objektu.
+  prof_start(tc);
+  u.edges = (Merge *)malloc((size_t)n_new * (YAO_CONES + 1) * sizeof(*u.edges));
+  CHECK(u.edges != NULL, update_cleanup(&u), false, "Failed to allocate memory for new edges.");
+  if (!grid_build(&u.grid, u.objs, n)) {
+    update_cleanup(&u);
+    return false;
+  }
+  int n_edges = 0;
+  for (int p = n_old; p < n; p++)
+    n_edges += yao_edges(&u.grid, u.objs, p, u.edges + n_edges);
+  prof_phase(neighbours, t);
+
+  qsort(u.edges, n_edges, sizeof(*u.edges), edge_compar);
+  if (!kruskal_merge(&u.old, u.edges, n_edges, &u.ids, n, &u.updated)) {
+    update_cleanup(&u);
+    return false;
+  }
+  prof_phase(merge, t);
+
+  if (args->snapshot_out != NULL && !snapshot_save(u.objs, &u.updated, args->snapshot_out)) {
+    update_cleanup(&u);
+    return false;
+  }
+
+  // Rez podle vzdalenosti ignoruje pozadovany pocet shluku.
+  if (args->threshold >= 0.0f)
+    u.n_cut = linkage_cut(&u.updated, u.objs, n, 1, args->threshold * args->threshold, &u.cut);
+  else
+    u.n_cut = linkage_cut(&u.updated, u.objs, n, args->n_clusters, INFINITY, &u.cut);
+  if (u.n_cut == 0) {
+    update_cleanup(&u);
+    return false;
+  }
+  prof_phase(cluster, tc);
+
+  print_clusters(u.cut, u.n_cut);
+  prof_phase(print, tc);
+  update_cleanup(&u);
+  return true;
+}
+
+/*****************************************************************
+ * Proudovy k-means po davkach (mini-batch k-means).
+ *
+ * Soubor se cte dvakrat po davkach o 'batch_size' objektech. V prvnim pruchodu
+ * se centroidy inicializuji prvnimi 'k' objekty a pote se posouvaji smerem
+ * k objektum z davek s ucicim koeficientem 1/v, kde v je pocet objektu, ktere
+ * dosud centroid pritahl. Ve druhem pruchodu se pro kazdy objekt vypise index
+ * nejblizsiho centroidu. Pamet je O(k + batch_size) bez ohledu na velikost
+ * vstupu, proto se v tomto rezimu nekontroluje unikatnost ID.
+ */
+
+typedef struct stream_kmeans_t {
+  int   k;
+  float *cx;      // Souradnice x centroidu.
+  float *cy;      // Souradnice y centroidu.
+  long  *counts;  // Pocet objektu, ktere centroid dosud pritahl.
+} StreamKMeans;
+
+// Vrati index centroidu nejblizsiho bodu [x, y].
+int nearest_centroid(const StreamKMeans *km, float x, float y)
+{
+  float dist;
+  prof_count(dist_evals, km->k);
+  return kern->argmin(x, y, km->cx, km->cy, km->k, &dist);
+}
+
+void stream_kmeans_free(StreamKMeans *km)
+{
+  free(km->cx);
+  free(km->cy);
+  free(km->counts);
+  km->cx = km->cy = NULL;
+  km->counts = NULL;
+}
+
+bool stream_kmeans_init(StreamKMeans *km, int k)
+{
+  km->k = k;
+  km->cx = (float *)malloc(k * sizeof(*km->cx));
+  km->cy = (float *)malloc(k * sizeof(*km->cy));
+  km->counts = (long *)calloc(k, sizeof(*km->counts));
+  CHECK(km->cx && km->cy && km->counts, stream_kmeans_free(km), false, "Failed to allocate memory for centroids.");
+  return true;
+}
+
+/*
+ Zpracuje jednu davku objektu. Nejdrive priradi vsechny objekty davky
+ k centroidum a teprve potom centroidy posune, aby prirazeni v ramci davky
+ nezaviselo na poradi objektu. Pole 'assign' ma velikost alespon 'n'.
+*/
+void stream_kmeans_step(StreamKMeans *km, const struct obj_t *batch, int n, int *assign)
+{
+  for (int i = 0; i < n; i++)
+    assign[i] = nearest_centroid(km, batch[i].x, batch[i].y);
+
+  for (int i = 0; i < n; i++) {
+    int c = assign[i];
+    float eta = 1.0f / (float)(++km->counts[c]);
+    km->cx[c] += eta * (batch[i].x - km->cx[c]);
+    km->cy[c] += eta * (batch[i].y - km->cy[c]);
+  }
+}
+
+void stream_cleanup(StreamKMeans *km, struct obj_t *batch, int *assign, ObjReader *reader)
+{
+  stream_kmeans_free(km);
+  free(batch);
+  free(assign);
+  reader_close(reader);
+}
+
+/*
+ Proudove shlukovani souboru 'filename' do 'k' shluku. Vypise centroidy
+ a prirazeni objektu ke shlukum ve formatu 'ID INDEX_SHLUKU'.
+*/
+bool stream_method(const char *filename, int k, int batch_size)
+{
+  StreamKMeans km = { 0 };
+  ObjReader reader = { 0 };
+  // Cteni souboru se pocita do faze 'load', zbytek do 'cluster' a 'print'.
+  prof_start(t);
+  if (!reader_open(&reader, filename))
+    return false;
+  CHECK(reader.n_total >= k, reader_close(&reader), false, "Number of wanted clusters is too high.");
+
+  // Prvni davka musi obsahovat vsechny pocatecni centroidy.
+  if (batch_size < k)
+    batch_size = k;
+  struct obj_t *batch = (struct obj_t *)malloc(batch_size * sizeof(*batch));
+  int *assign = (int *)malloc(batch_size * sizeof(*assign));
+  CHECK(batch && assign && stream_kmeans_init(&km, k), stream_cleanup(&km, batch, assign, &reader), false, "Failed to allocate memory for stream batch.");
+
+  // Prvni pruchod: uceni centroidu.
+  int n = reader_next_batch(&reader, batch, batch_size);
+  prof_phase(load, t);
+  CHECK(n >= k, stream_cleanup(&km, batch, assign, &reader), false, "Failed to read initial centroids.");
+  for (int c = 0; c < k; c++) {
+    km.cx[c] = batch[c].x;
+    km.cy[c] = batch[c].y;
+    km.counts[c] = 1;
+  }
+  stream_kmeans_step(&km, batch + k, n - k, assign);
+  prof_phase(cluster, t);
+  while ((n = reader_next_batch(&reader, batch, batch_size)) > 0) {
+    prof_phase(load, t);
+    stream_kmeans_step(&km, batch, n, assign);
+    prof_phase(cluster, t);
+  }
+  CHECK(n == 0, stream_cleanup(&km, batch, assign, &reader), false, "Failed to read objects from file '%s'.", filename);
+  reader_close(&reader);
+  prof_phase(load, t);
+
+  printf("Centroids:\n");
+  for (int c = 0; c < k; c++)
+    printf("centroid %d: [%g,%g]\n", c, km.cx[c], km.cy[c]);
+  prof_phase(print, t);
+
+  // Druhy pruchod: prirazeni objektu ke shlukum. Soubor uz byl jednou
+  // zkontrolovan, takze chyba zde znamena zmenu souboru mezi pruchody.
+  if (!reader_open(&reader, filename)) {
+    stream_cleanup(&km, batch, assign, &reader);
+    return false;
+  }
+  printf("Assignments:\n");
+  prof_phase(load, t);
+  while ((n = reader_next_batch(&reader, batch, batch_size)) > 0) {
+    prof_phase(load, t);
+    for (int i = 0; i < n; i++)
+      assign[i] = nearest_centroid(&km, batch[i].x, batch[i].y);
+    prof_phase(cluster, t);
+    for (int i = 0; i < n; i++)
+      printf("%d %d\n", batch[i].id, assign[i]);
+    prof_phase(print, t);
+  }
+  CHECK(n == 0, stream_cleanup(&km, batch, assign, &reader), false, "Failed to read objects from file '%s'.", filename);
+
+  stream_cleanup(&km, batch, assign, &reader);
+  return true;
+}
+
+int main(int argc, char *argv[])
 {
   struct cluster_t *clusters = NULL;
 
@@ -459,7 +2812,30 @@ int main(int argc, char *argv[])
     return EXIT_FAILURE;
   }
 
+  CHECK(kernels_select(args.kernel), (void)0, EXIT_FAILURE, "Distance kernel '%s' is not available.", args.kernel);
+
+  // Prevod do binarniho formatu nic neshlukuje.
+  if (args.convert_to != NULL)
+    return convert_objects(args.filename, args.convert_to) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+  // Proudovy rezim nenacita vsechny objekty do pameti.
+  if (args.stream) {
+    bool ok = stream_method(args.filename, args.n_clusters, args.batch_size);
+    if (ok && args.profile)
+      print_profile();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  // Soubor obsahuje jen objekty pridavane ke snimku.
+  if (args.update_from != NULL) {
+    bool ok = update_method(&args);
+    if (ok && args.profile)
+      print_profile();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
   // Nacteni clusteru ze souboru.
+  prof_start(t);
   int n_loaded_clusters = load_clusters(args.filename, &clusters);
   if (clusters == NULL)
     return EXIT_FAILURE;
@@ -467,16 +2843,49 @@ int main(int argc, char *argv[])
   // Pocet pozadovanych clusteru nesmi byt veci nez pocet bodu v souboru.
   CHECK(n_loaded_clusters >= args.n_clusters, delete_clusters(&clusters, n_loaded_clusters), EXIT_FAILURE, "Number of wanted clusters is too high.");
 
+  // Slouceni stejnych bodu. Pokud je pozadovano vic shluku, nez je ruznych
+  // mist, shlukuje se bez slouceni.
+  Dedup dd = { 0 };
+  const Dedup *ddp = NULL;
+  int narr = n_loaded_clusters;
+  if (args.snap > 0) {
+    if (!dedup_build(&dd, clusters, narr, args.snap)) {
+      delete_clusters(&clusters, n_loaded_clusters);
+      return EXIT_FAILURE;
+    }
+    if (dd.n_sites >= args.n_clusters || args.threshold >= 0.0f) {
+      narr = dedup_apply(&dd, clusters, narr);
+      ddp = &dd;
+    }
+  }
+  prof_phase(load, t);
+
+  // Prace s celou historii slucovani.
+  if (args.chain || args.linkage_in != NULL || args.linkage_out != NULL || args.snapshot_out != NULL || args.threshold >= 0.0f) {
+    bool ok = dendrogram_method(&args, clusters, narr, ddp);
+    delete_clusters(&clusters, n_loaded_clusters);
+    dedup_free(&dd);
+    packed_free();
+    if (ok && args.profile)
+      print_profile();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
   if (n_loaded_clusters != args.n_clusters) {
-      nn_method(clusters, n_loaded_clusters, args.n_clusters);
+      nn_method(clusters, narr, args.n_clusters, NULL, NULL);
   }
   else {
     perr("k-means not impleneted yet.");
   }
+  prof_phase(cluster, t);
 
-  print_clusters(clusters, args.n_clusters);
+  print_expanded(ddp, clusters, args.n_clusters);
+  prof_phase(print, t);
   delete_clusters(&clusters, n_loaded_clusters);
+  dedup_free(&dd);
+  packed_free();
+  if (args.profile)
+    print_profile();
 
   return EXIT_SUCCESS;
 }
-
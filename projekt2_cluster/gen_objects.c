@@ -0,0 +1,113 @@
+/**
+ * Generator vstupnich souboru pro benchmark programu cluster.
+ *
+ * Pouziti: ./gen_objects DRUH POCET [SEMINKO] > soubor
+ *   DRUH:
+ *     uniform - body rovnomerne rozlozene po cele plose,
+ *     blobs   - body v gaussovskych shlucich kolem nahodnych stredu,
+ *     dups    - body na nejvyse 1000 mistech (mnoho stejnych souradnic).
+ *
+ * Pro stejne seminko vznikne na vsech platformach stejny soubor, protoze
+ * generator nepouziva rand() ze standardni knihovny.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#define perr(fmt, ...) fprintf(stderr, __FILE__ ":%i - error: " fmt "\n", __LINE__, ##__VA_ARGS__)
+#define MAX_XY_VALUE 1000
+// Pocet stredu shluku pro druh 'blobs'.
+#define N_BLOBS 16
+// Nejvyssi pocet ruznych mist pro druh 'dups'.
+#define MAX_DUP_SITES 1000
+#define PI 3.14159265358979323846
+
+// Stav generatoru xorshift64*.
+uint64_t rng_state = 0;
+
+uint64_t rng_next(void)
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 2685821657736338717ull;
+}
+
+// Nahodne cele cislo z intervalu <0, n).
+int rng_int(int n)
+{
+  return (int)(rng_next() % (uint64_t)n);
+}
+
+// Nahodne realne cislo z intervalu (0, 1).
+double rng_unit(void)
+{
+  return ((rng_next() >> 11) + 0.5) / 9007199254740992.0;
+}
+
+// Nahodne cislo z normalniho rozdeleni N(0, 1) (Box-Muller).
+double rng_gauss(void)
+{
+  return sqrt(-2.0 * log(rng_unit())) * cos(2.0 * PI * rng_unit());
+}
+
+int clamp_xy(double v)
+{
+  int i = (int)lround(v);
+  return i < 0 ? 0 : (i > MAX_XY_VALUE ? MAX_XY_VALUE : i);
+}
+
+int main(int argc, char *argv[])
+{
+  char *end = NULL;
+  long n = argc >= 3 ? strtol(argv[2], &end, 10) : 0;
+  if (argc < 3 || argc > 4 || *end != '\0' || n < 1 || n > 2147483647L) {
+    perr("Usage: %s uniform|blobs|dups COUNT [SEED]", argv[0]);
+    return EXIT_FAILURE;
+  }
+  rng_state = argc == 4 ? strtoull(argv[3], NULL, 10) : 1;
+  // Nulovy stav by generoval jen nuly.
+  rng_state = rng_state * 0x9E3779B97F4A7C15ull + 1;
+
+  bool blobs = strcmp(argv[1], "blobs") == 0;
+  bool dups = strcmp(argv[1], "dups") == 0;
+  if (!blobs && !dups && strcmp(argv[1], "uniform") != 0) {
+    perr("Unknown dataset kind '%s'.", argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  // Stredy shluku (blobs) nebo mista, na kterych lezi vsechny body (dups).
+  int cx[MAX_DUP_SITES], cy[MAX_DUP_SITES];
+  int n_centers = 0;
+  if (blobs)
+    n_centers = N_BLOBS;
+  else if (dups)
+    n_centers = n / 10 < 1 ? 1 : (n / 10 > MAX_DUP_SITES ? MAX_DUP_SITES : (int)(n / 10));
+  for (int c = 0; c < n_centers; c++) {
+    cx[c] = rng_int(MAX_XY_VALUE + 1);
+    cy[c] = rng_int(MAX_XY_VALUE + 1);
+  }
+
+  printf("count=%ld\n", n);
+  for (long i = 0; i < n; i++) {
+    int x, y;
+    if (blobs) {
+      int c = rng_int(N_BLOBS);
+      x = clamp_xy(cx[c] + 40.0 * rng_gauss());
+      y = clamp_xy(cy[c] + 40.0 * rng_gauss());
+    } else if (dups) {
+      int c = rng_int(n_centers);
+      x = cx[c];
+      y = cy[c];
+    } else {
+      x = rng_int(MAX_XY_VALUE + 1);
+      y = rng_int(MAX_XY_VALUE + 1);
+    }
+    printf("%ld %d %d\n", i + 1, x, y);
+  }
+
+  return EXIT_SUCCESS;
+}
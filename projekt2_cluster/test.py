@@ -9,13 +9,20 @@
 
 import argparse
 import json
+import math
 import os
+import random
+import struct
 from signal import SIGSEGV
 from subprocess import CompletedProcess, run, PIPE
 from typing import Dict, List, Tuple, Optional
 
 TEST_LOG_FILENAME = "log.json"
 INPUT_FILENAME = "test.in"
+OLD_INPUT_FILENAME = "test_old.in"
+SNAPSHOT_FILENAME = "test.snap"
+UPDATED_SNAPSHOT_FILENAME = "test_updated.snap"
+FULL_SNAPSHOT_FILENAME = "test_full.snap"
 VALGRIND_LOG_FILENAME = "valgrind_log.txt"
 
 PASS = "\033[38;5;154m[OK]\033[0m"
@@ -71,6 +78,29 @@ NON_UNIQUE_ID_INPUT = [("1", "1", "2"), ("1", "4", "8")]
 
 MULITPLE_OBJECTS_INPUT = [("1", "1", "2", "3", "4", "5")]
 
+# Stejne body v novych objektech (--update).
+UPDATE_TWINS_OLD = [("1", "510", "502"), ("2", "0", "0"), ("3", "1000", "1000")]
+
+UPDATE_TWINS_NEW = [("10", "500", "500"), ("11", "500", "500")]
+
+UPDATE_ONLY_TWINS_OLD = [("1", "10", "5")]
+
+UPDATE_ONLY_TWINS_NEW = [("10", "0", "0"), ("11", "0", "0")]
+
+
+def blobs_input(n: int, seed: int) -> List[Tuple[str, str, str]]:
+    """Shluky bodu kolem nekolika stredu, diky zaokrouhleni s mnoha stejnymi body."""
+    rnd = random.Random(seed)
+    centers = [(rnd.randint(100, 900), rnd.randint(100, 900)) for _ in range(5)]
+    out = []
+    for i in range(n):
+        cx, cy = rnd.choice(centers)
+        x = min(max(round(rnd.gauss(cx, 20)), 0), 1000)
+        y = min(max(round(rnd.gauss(cy, 20)), 0), 1000)
+        out.append((str(i + 1), str(x), str(y)))
+    return out
+
+
 OUTPUT_1 = [(i + 1,) for i in range(20)]
 
 OUTPUT_2 = [
@@ -235,6 +265,104 @@ class Tester:
 
             exit(1)
 
+    def test_update(
+        self,
+        test_name: str,
+        old_input: List[Tuple[str, str, str]],
+        new_input: List[Tuple[str, str, str]],
+        n_clusters: int,
+    ):
+        """
+        Prida 'new_input' ke snimku 'old_input' (--update) a porovna vahu
+        doplnene kostry s kostrou spocitanou znovu ze vsech objektu. Rezy se
+        pri shodnych vzdalenostech mohou lisit, vaha minimalni kostry ne.
+        """
+        self.test_count += 1
+        error_msg = ""
+
+        self.create_input_file(old_input, OLD_INPUT_FILENAME)
+        self.create_input_file(new_input, INPUT_FILENAME)
+        snapshot_args = [OLD_INPUT_FILENAME, "1", f"--save-snapshot={SNAPSHOT_FILENAME}"]
+        update_args = [INPUT_FILENAME, str(n_clusters), f"--update={SNAPSHOT_FILENAME}",
+                       f"--save-snapshot={UPDATED_SNAPSHOT_FILENAME}"]
+        full_args = [INPUT_FILENAME, str(n_clusters), f"--save-snapshot={FULL_SNAPSHOT_FILENAME}"]
+
+        snapshot = run([self.program_name] + snapshot_args, stdout=PIPE, stderr=PIPE, encoding="ascii")
+        p = run([self.program_name] + update_args, stdout=PIPE, stderr=PIPE, encoding="ascii")
+        self.create_input_file(old_input + new_input, INPUT_FILENAME)
+        full = run([self.program_name] + full_args, stdout=PIPE, stderr=PIPE, encoding="ascii")
+
+        if snapshot.returncode != 0 or full.returncode != 0:
+            error_msg += f"Snimek nebo kostru vsech objektu se nepodarilo spocitat: {snapshot.stderr}{full.stderr}\n"
+        elif p.returncode != 0:
+            error_msg += f"Program vratil chybovy navratovy kod {p.returncode} prestoze nemel\n"
+        else:
+            updated = self.snapshot_weight(UPDATED_SNAPSHOT_FILENAME)
+            expected = self.snapshot_weight(FULL_SNAPSHOT_FILENAME)
+            if not math.isclose(updated, expected, rel_tol=1e-6, abs_tol=1e-3):
+                error_msg += f"Vaha doplnene kostry {updated:.3f} neni minimalni ({expected:.3f})\n"
+
+        valgrind_out = ""
+        if self.valgrind_enabled and (valgrind_out := self.check_memory(update_args)):
+            error_msg += "Valgrind nasel chybu\n"
+
+        if error_msg:
+            self.print_fail(test_name)
+            print(error_msg)
+            print(f"{self.bold('Argumenty')}: {' '.join(update_args)}")
+            print(f"{self.bold('STDOUT')}:")
+            print(self.debug(p.stdout))
+            print(f"{self.bold('STDERR')}:")
+            print(self.debug(p.stderr))
+            if valgrind_out:
+                print(f"{self.bold('Valgrind')}:")
+                print(self.debug(valgrind_out))
+        else:
+            self.pass_count += 1
+            self.print_pass(test_name)
+
+        self.logs.append(
+            {
+                "test_name": test_name,
+                "status": "failed" if error_msg else "ok",
+                "error_message": error_msg,
+                "args": " ".join(update_args),
+                "stdout": p.stdout,
+                "stderr": p.stderr,
+                "return_code": p.returncode,
+                "valgrind": valgrind_out,
+            }
+        )
+
+        self.test_cleanup()
+        for filename in [OLD_INPUT_FILENAME, SNAPSHOT_FILENAME, UPDATED_SNAPSHOT_FILENAME, FULL_SNAPSHOT_FILENAME]:
+            try:
+                os.remove(f"./{filename}")
+            except Exception:
+                pass
+
+        if error_msg and self.stop_on_error:
+            self.valgrind_cleanup()
+
+            if self.save_logs_file:
+                t.save_logs()
+
+            t.print_stats()
+
+            exit(1)
+
+    @staticmethod
+    def snapshot_weight(filename: str) -> float:
+        """Soucet delek hran kostry ve snimku (hlavicka IZPS, objekty, slouceni)."""
+        with open(filename, "rb") as f:
+            data = f.read()
+        n_obj, n_merges = struct.unpack_from("<ii", data, 8)
+        offset = 16 + 12 * n_obj
+        return sum(
+            math.sqrt(struct.unpack_from("<iifi", data, offset + 16 * m)[2])
+            for m in range(n_merges)
+        )
+
     def check_memory(self, args: List[str]) -> str:
         try:
             run(
@@ -612,6 +740,12 @@ if __name__ == "__main__":
         should_fail=True,
     )
 
+    t.test_update("Test aktualizace snimku #1", UPDATE_TWINS_OLD, UPDATE_TWINS_NEW, 3)
+    t.test_update("Test aktualizace snimku #2", UPDATE_ONLY_TWINS_OLD, UPDATE_ONLY_TWINS_NEW, 2)
+    for i, seed in enumerate([11, 20, 52, 55]):
+        blobs = blobs_input(300, seed)
+        t.test_update(f"Test aktualizace snimku #{i + 3}", blobs[:200], blobs[200:], 5)
+
     if args.save_logs:
         t.save_logs()
 